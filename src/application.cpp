@@ -13,11 +13,15 @@ static Ref<ConfigVar<std::string>> server_work_path = Config::Lookup("server.wor
 static Ref<ConfigVar<std::string>> server_pid_file = Config::Lookup("server.pid.file", 
     std::string("TinyServer.pid"), "server pid path");
 
+static Ref<ConfigVar<int>> server_work_threads = Config::Lookup("server.work.threads", 
+    1, "io worker threads");
+
 struct HttpServerConf
 {
     std::vector<std::string> address;
     int keepalive = 0;
     int timeout = 1000 * 2 *60;
+    int reuse_port = 0;     //每个工作线程一个SO_REUSEPORT监听socket
     std::string name;
 
     bool isValid() const
@@ -30,6 +34,7 @@ struct HttpServerConf
         return address == oth.address
             && keepalive == oth.keepalive
             && timeout == oth.timeout
+            && reuse_port == oth.reuse_port
             && name == oth.name;
     }
 };
@@ -44,6 +49,7 @@ public:
         HttpServerConf conf;
         conf.keepalive = node["keepalive"].as<int>(conf.keepalive);
         conf.timeout = node["timeout"].as<int>(conf.timeout);
+        conf.reuse_port = node["reuse_port"].as<int>(conf.reuse_port);
         conf.name = node["name"].as<std::string>(conf.name);
         if (node["address"].IsDefined())
         {
@@ -66,6 +72,7 @@ public:
         node["name"] = conf.name;
         node["keepalive"] = conf.keepalive;
         node["timeout"] = conf.timeout;
+        node["reuse_port"] = conf.reuse_port;
         for (auto& item : conf.address)
         {
             node["address"].push_back(item);
@@ -156,7 +163,7 @@ int Application::main(int argc, char** argv)
     }
     ofs << getpid();
 
-    IOManager iom(1);
+    IOManager iom(std::max(1, server_work_threads->getValue()));
     iom.schedule(std::bind(&Application::run_fiber, this));
     iom.stop();
     return true;
@@ -200,6 +207,7 @@ int Application::run_fiber()
             }
         }
         Ref<http::HttpServer> server(new http::HttpServer(item.keepalive));
+        server->setReusePort(item.reuse_port);
         std::vector<Ref<Address>> fails;
         if (!server->bind(addrs, fails))
         {
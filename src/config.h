@@ -3,6 +3,8 @@
 #include <iostream>
 #include <unordered_set>
 #include <unordered_map>
+#include <atomic>
+#include <deque>
 #include "thread.h"
 #include "log.h"
 #include "yaml-cpp/yaml.h"
@@ -315,6 +317,28 @@ public:
                             lad.formatter = ap["formatter"].as<std::string>();
                         }
                     }
+                    else if (type == "AsyncFileLog")
+                    {
+                        lad.type = 3;
+                        if (!ap["file"].IsDefined())
+                        {
+                            std::cout << "log config error: async file appender file path is null," << std::endl;
+                            continue;
+                        }
+                        lad.file = ap["file"].as<std::string>();
+                        if (ap["formatter"].IsDefined())
+                        {
+                            lad.formatter = ap["formatter"].as<std::string>();
+                        }
+                        lad.flush_interval = ap["flush_interval"].as<uint32_t>(lad.flush_interval);
+                        lad.buffer_size = ap["buffer_size"].as<uint32_t>(lad.buffer_size);
+                        lad.overflow = ap["overflow"].as<std::string>(lad.overflow);
+                        if (lad.overflow != "block" && lad.overflow != "drop")
+                        {
+                            std::cout << "log config error: async file appender overflow is invalid," << std::endl;
+                            continue;
+                        }
+                    }
                     else if (type == "ConsoleLog")
                     {
                         lad.type = 2;
@@ -362,6 +386,14 @@ public:
                 {
                     na["type"] = "ConsoleLog";
                 }
+                else if (i.type == 3)
+                {
+                    na["type"] = "AsyncFileLog";
+                    na["file"] = i.file;
+                    na["flush_interval"] = i.flush_interval;
+                    na["buffer_size"] = i.buffer_size;
+                    na["overflow"] = i.overflow;
+                }
                 //little bug item.level ==> i.level
                 //否则appender还是会出现UNKNOW
                 if (i.level != LogLevel::UNKNOW)
@@ -390,27 +422,54 @@ public:
     typedef RWLock RWMutexType;
 
     ConfigVar(const std::string& name, const T& default_value, const std::string& description = "")
-        : ConfigVarBase(name ,description), m_val(default_value) {}
+        : ConfigVarBase(name ,description), m_current(std::make_shared<T>(default_value)), m_val(m_current.get()) {}
 
-    const T& getValue()
+    //读取不加锁，只有一次acquire的原子读
+    //值被替换后旧值至少再保留RETIRE_GRACE_MS毫秒，返回的引用只能短时间使用，需要长期持有时用getSnapshot
+    const T& getValue() const
+    {
+        return *m_val.load(std::memory_order_acquire);
+    }
+
+    //当前值的快照，持有期间一直有效
+    Ref<const T> getSnapshot() const
     {
         RWMutexType::ReadLockGuard lock(m_mutex);
-        return m_val; 
+        return m_current;
     }
 
+    //发布新值后在m_mutex外触发回调，回调里可以再读写这个配置项
+    //回调由m_cbMutex串行化，按发布的顺序执行；回调中的setValue只发布，通知排在当前这一轮之后
     void setValue(const T& value)
     {
+        if (m_notifyThread.load(std::memory_order_relaxed) == GetThreadId())
         {
-            RWMutexType::ReadLockGuard lock(m_mutex); 
-            if (m_val == value) //operator==??
-                return;
-            for (auto& item : m_callbacks)
+            publish(value);
+            return;
+        }
+        MutexLock::MutexLockGuard cb_lock(m_cbMutex);
+        if (!publish(value))
+            return;
+        m_notifyThread = GetThreadId();
+        try
+        {
+            while (!m_pending.empty())
             {
-                item.second(m_val, value);
+                Notify notify = std::move(m_pending.front());
+                m_pending.pop_front();
+                for (auto& cb : notify.cbs)
+                {
+                    cb(*notify.old_val, *notify.new_val);
+                }
             }
         }
-        RWMutexType::WriteLockGuard lock(m_mutex);
-        m_val = value;
+        catch (...)
+        {
+            m_pending.clear();
+            m_notifyThread = -1;
+            throw;
+        }
+        m_notifyThread = -1;
     }
 
     uint64_t setCallBack(ConfigChangeCB cb)
@@ -447,14 +506,13 @@ public:
     {
         try
         {
-            RWMutexType::ReadLockGuard lock(m_mutex);
             //return boost::lexical_cast<std::string>(m_val);
-            return ToStr()(m_val);
+            return ToStr()(getValue());
         }
         catch(const std::exception& e)
         {
             TINY_LOG_ERROR(TINY_LOG_ROOT) << "Configvar::toString exception" << e.what() 
-            << "convert " << typeid(m_val).name() << " to string";
+            << "convert " << typeid(T).name() << " to string";
         }
         return "";
     }
@@ -469,15 +527,58 @@ private:
         catch(const std::exception& e)
         {
             TINY_LOG_ERROR(TINY_LOG_ROOT) << "Configvar::fromString exception" << e.what() 
-            << "convert: string to " << typeid(m_val).name();
+            << "convert: string to " << typeid(T).name();
         }
         return false; 
     }
 
+    //发布新值并把回调通知排入m_pending，调用时持有m_cbMutex，值没有变化返回false
+    bool publish(const T& value)
+    {
+        Notify notify;
+        {
+            RWMutexType::WriteLockGuard lock(m_mutex);
+            if (*m_current == value) //operator==??
+                return false;
+            //getValue的读者可能还在使用旧值，过了宽限期再释放
+            uint64_t now = GetCurrentMs();
+            while (!m_retired.empty() && m_retired.front().first + RETIRE_GRACE_MS <= now)
+            {
+                m_retired.pop_front();
+            }
+            m_retired.push_back(std::make_pair(now, m_current));
+            notify.old_val = m_current;
+            m_current = std::make_shared<T>(value);
+            notify.new_val = m_current;
+            m_val.store(m_current.get(), std::memory_order_release);
+            notify.cbs.reserve(m_callbacks.size());
+            for (auto& item : m_callbacks)
+            {
+                notify.cbs.push_back(item.second);
+            }
+        }
+        m_pending.push_back(std::move(notify));
+        return true;
+    }
+
 private:
-    T m_val;
+    static const uint64_t RETIRE_GRACE_MS = 10 * 1000;
+
+    struct Notify
+    {
+        Ref<const T> old_val;
+        Ref<const T> new_val;
+        std::vector<ConfigChangeCB> cbs;
+    };
+
+    Ref<const T> m_current;                     //当前值
+    std::atomic<const T*> m_val;                //m_current.get()，供getValue无锁读取
+    std::deque<std::pair<uint64_t, Ref<const T>>> m_retired;   //被替换的值和替换的时间
     std::map<uint64_t, ConfigChangeCB> m_callbacks;
-    RWMutexType m_mutex;
+    mutable RWMutexType m_mutex;
+    MutexLock m_cbMutex;                        //串行化回调
+    std::deque<Notify> m_pending;               //待执行的回调通知，持有m_cbMutex时访问
+    std::atomic<int> m_notifyThread = {-1};     //正在执行回调的线程
 };
 
 class Config
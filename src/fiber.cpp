@@ -2,6 +2,9 @@
 #include "config.h"
 #include "macro.h"
 #include <atomic>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "scheduler.h"
 
 namespace TinyServer
@@ -9,12 +12,63 @@ namespace TinyServer
 static Ref<Logger> logger = TINY_LOG_NAME("system");
 static std::atomic<uint64_t> s_fiber_id {0};
 static std::atomic<uint64_t> s_fiber_count {0};
+static std::atomic<uint64_t> s_cache_hit {0};
+static std::atomic<uint64_t> s_cache_miss {0};
 
 static thread_local Fiber* t_fiber = nullptr;
 static thread_local Ref<Fiber> t_threadFiber = nullptr; // ==> main fiber
 
 static Ref<ConfigVar<uint32_t>> fiber_stack_size = Config::Lookup<uint32_t>("fiber.stack.size", 1024 * 1024, "fiber stack size");
 
+static Ref<ConfigVar<std::string>> fiber_stack_allocator = Config::Lookup<std::string>("fiber.stack.allocator", 
+    std::string("mmap"), "fiber stack allocator, mmap or malloc");
+
+static Ref<ConfigVar<uint32_t>> fiber_stack_pool_size = Config::Lookup<uint32_t>("fiber.stack.pool_size", 
+    64, "max free fiber stacks cached per thread");
+
+static Ref<ConfigVar<uint32_t>> fiber_cache_size = Config::Lookup<uint32_t>("fiber.cache.size", 
+    32, "max terminated fibers cached per thread for reuse");
+
+static bool s_use_mmap_stack = true;
+static uint32_t s_stack_pool_size = 0;
+static uint32_t s_default_stack_size = 0;
+static uint32_t s_fiber_cache_size = 0;
+
+namespace
+{
+struct FiberIniter
+{
+    FiberIniter()
+    {
+        s_use_mmap_stack = fiber_stack_allocator->getValue() != "malloc";
+        s_stack_pool_size = fiber_stack_pool_size->getValue();
+        s_default_stack_size = fiber_stack_size->getValue();
+        s_fiber_cache_size = fiber_cache_size->getValue();
+
+        fiber_stack_allocator->setCallBack([](const std::string& old_value, const std::string& new_value){
+            s_use_mmap_stack = new_value != "malloc";
+        });
+
+        fiber_stack_pool_size->setCallBack([](const uint32_t& old_value, const uint32_t& new_value){
+            s_stack_pool_size = new_value;
+        });
+
+        fiber_stack_size->setCallBack([](const uint32_t& old_value, const uint32_t& new_value){
+            s_default_stack_size = new_value;
+        });
+
+        fiber_cache_size->setCallBack([](const uint32_t& old_value, const uint32_t& new_value){
+            s_fiber_cache_size = new_value;
+        });
+    }
+};
+
+static FiberIniter __fiber_initer;
+
+//每个线程缓存已结束的协程(连同其栈)，调度回调时直接reset复用
+static thread_local std::vector<Ref<Fiber>> t_fiberCache;
+}
+
 class MallocStackAllocator
 {
 public:
@@ -26,20 +80,127 @@ public:
     static void Dealloc(void* ptr, size_t size)
     {
         return free(ptr);
-        ptr = nullptr;
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+//栈由mmap分配，低地址处有一个PROT_NONE的保护页，栈溢出时直接触发SIGSEGV而不是破坏堆
+//释放的栈按线程缓存在一个空闲链表里(链表指针直接存放在空闲栈内存中)，只缓存当前默认大小的栈
+class MmapStackAllocator
+{
+public:
+    static void* Alloc(size_t size)
+    {
+        if (size == t_freeSize && t_freeList)
+        {
+            void* ptr = t_freeList;
+            t_freeList = *(void**)ptr;
+            --t_freeCount;
+            return ptr;
+        }
+        size_t page = PageSize();
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            TINY_LOG_ERROR(logger) << "mmap fiber stack fail size = " << size 
+                << " errno = " << errno << " errstr = " << strerror(errno);
+            return nullptr;
+        }
+        if (mprotect(base, page, PROT_NONE))
+        {
+            TINY_LOG_ERROR(logger) << "mprotect fiber stack guard page fail errno = " << errno
+                << " errstr = " << strerror(errno);
+        }
+        return (char*)base + page;
+    }
+
+    static void Dealloc(void* ptr, size_t size)
+    {
+        if (!t_poolClosed && t_freeCount < s_stack_pool_size && (!t_freeList || size == t_freeSize))
+        {
+            *(void**)ptr = t_freeList;
+            t_freeList = ptr;
+            t_freeSize = size;
+            ++t_freeCount;
+            if (!t_poolCleaner.armed)
+                t_poolCleaner.armed = true;
+            return;
+        }
+        Unmap(ptr, size);
+    }
+
+private:
+    static size_t PageSize()
+    {
+        static size_t s_page = sysconf(_SC_PAGESIZE);
+        return s_page;
+    }
+
+    static void Unmap(void* ptr, size_t size)
+    {
+        size_t page = PageSize();
+        munmap((char*)ptr - page, size + page);
+    }
+
+    //线程退出时归还缓存的栈
+    struct PoolCleaner
+    {
+        bool armed = false;
+        ~PoolCleaner()
+        {
+            while (t_freeList)
+            {
+                void* ptr = t_freeList;
+                t_freeList = *(void**)ptr;
+                Unmap(ptr, t_freeSize);
+            }
+            t_freeCount = 0;
+            t_poolClosed = true;
+        }
+    };
+
+    //空闲链表使用平凡析构的thread_local，PoolCleaner析构后仍可安全访问
+    static thread_local void* t_freeList;
+    static thread_local size_t t_freeSize;
+    static thread_local uint32_t t_freeCount;
+    static thread_local bool t_poolClosed;
+    static thread_local PoolCleaner t_poolCleaner;
+};
+
+thread_local void* MmapStackAllocator::t_freeList = nullptr;
+thread_local size_t MmapStackAllocator::t_freeSize = 0;
+thread_local uint32_t MmapStackAllocator::t_freeCount = 0;
+thread_local bool MmapStackAllocator::t_poolClosed = false;
+thread_local MmapStackAllocator::PoolCleaner MmapStackAllocator::t_poolCleaner;
+
+class StackAllocator
+{
+public:
+    static void* Alloc(size_t size, bool& use_mmap)
+    {
+        use_mmap = s_use_mmap_stack;
+        return use_mmap ? MmapStackAllocator::Alloc(size) : MallocStackAllocator::Alloc(size);
+    }
+
+    static void Dealloc(void* ptr, size_t size, bool use_mmap)
+    {
+        if (use_mmap)
+            MmapStackAllocator::Dealloc(ptr, size);
+        else
+            MallocStackAllocator::Dealloc(ptr, size);
+    }
+};
 
 Fiber::Fiber()
 {
     m_state = EXEC;
     SetThis(this);
+#ifdef TINY_FIBER_USE_UCONTEXT
     if (::getcontext(&m_context))
     {
         TINY_ASSERT_P(false, "getcontext");
     }
+#endif
     ++s_fiber_count;
     TINY_LOG_DEBUG(logger) << "Fiber::Fiber id = " << m_id;
 }
@@ -48,20 +209,10 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_call)
     : m_id(++s_fiber_id), m_cb(cb)
 {
     ++s_fiber_count;
-    m_stacksize = m_stacksize ? stacksize : fiber_stack_size->getValue();
-    m_stack = StackAllocator::Alloc(m_stacksize);
-
-    if (::getcontext(&m_context))
-    {
-        TINY_ASSERT_P(false, "getcontext");
-    }
-    m_context.uc_link = nullptr;
-    m_context.uc_stack.ss_sp = m_stack;
-    m_context.uc_stack.ss_size = m_stacksize;
-    if (!use_call)
-        ::makecontext(&m_context, &MainFunc, 0);
-    else
-        ::makecontext(&m_context, &CallerMainFunc, 0);
+    m_stacksize = stacksize ? stacksize : fiber_stack_size->getValue();
+    m_stack = StackAllocator::Alloc(m_stacksize, m_mmapStack);
+    TINY_ASSERT_P(m_stack, "alloc fiber stack");
+    initContext(use_call);
     TINY_LOG_DEBUG(logger) << "Fiber::Fiber id = " << m_id;
 }
 
@@ -71,7 +222,7 @@ Fiber::~Fiber()
     if (m_stack)
     {
         TINY_ASSERT(m_state == State::TERM || m_state == State::INIT || m_state == State::EXCEPT);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        StackAllocator::Dealloc(m_stack, m_stacksize, m_mmapStack);
     }
     else
     {
@@ -85,22 +236,85 @@ Fiber::~Fiber()
     TINY_LOG_DEBUG(logger) << "Fiber::~Fiber id = " << m_id;
 }
 
-//重置协程函数，并重置状态
+//重置协程函数，并重置状态和id
 //INIT TERM
 void Fiber::reset(std::function<void()> cb)
 {
     TINY_ASSERT(m_stack);
     TINY_ASSERT(m_state == State::INIT || m_state == State::TERM || m_state == State::EXCEPT);
-    m_cb = cb;
-    if (getcontext(&m_context))
+    m_cb.swap(cb);
+    initContext(false);
+    m_state = State::INIT;
+    m_affinity = -1;
+    //复用的协程(包括从缓存中取出的)执行的是新任务，重新分配id，日志中不与之前的任务混淆
+    m_id = ++s_fiber_id;
+}
+
+void Fiber::initContext(bool use_call)
+{
+#ifdef TINY_FIBER_USE_UCONTEXT
+    if (::getcontext(&m_context))
     {
         TINY_ASSERT_P(false, "getcontext");
     }
     m_context.uc_link = nullptr;
     m_context.uc_stack.ss_sp = m_stack;
     m_context.uc_stack.ss_size = m_stacksize;
-    ::makecontext(&m_context, &MainFunc, 0);
-    m_state = State::INIT;
+    if (!use_call)
+        ::makecontext(&m_context, &MainFunc, 0);
+    else
+        ::makecontext(&m_context, &CallerMainFunc, 0);
+#else
+    m_sp = MakeFiberContext(m_stack, m_stacksize, use_call ? &CallerMainFunc : &MainFunc);
+#endif
+}
+
+void Fiber::SwapContext(Fiber* from, Fiber* to)
+{
+#ifdef TINY_FIBER_USE_UCONTEXT
+    if (::swapcontext(&from->m_context, &to->m_context))
+    {
+        TINY_ASSERT_P(false, "swapcontext");
+    }
+#else
+    tiny_swap_context(&from->m_sp, to->m_sp);
+#endif
+}
+
+Ref<Fiber> Fiber::Create(std::function<void()> cb)
+{
+    if (!t_fiberCache.empty())
+    {
+        Ref<Fiber> fiber;
+        fiber.swap(t_fiberCache.back());
+        t_fiberCache.pop_back();
+        fiber->reset(std::move(cb));
+        ++s_cache_hit;
+        return fiber;
+    }
+    ++s_cache_miss;
+    return Ref<Fiber>(new Fiber(std::move(cb)));
+}
+
+void Fiber::Recycle(Ref<Fiber>& fiber)
+{
+    //只回收没有其他引用、默认栈大小且已经结束的协程
+    if (fiber.use_count() == 1 && fiber->m_stack
+        && (fiber->m_state == State::TERM || fiber->m_state == State::EXCEPT)
+        && fiber->m_stacksize == s_default_stack_size
+        && t_fiberCache.size() < s_fiber_cache_size)
+    {
+        fiber->m_cb = nullptr;
+        t_fiberCache.push_back(nullptr);
+        t_fiberCache.back().swap(fiber);
+        return;
+    }
+    fiber.reset();
+}
+
+void Fiber::ClearCache()
+{
+    t_fiberCache.clear();
 }
 
 //切换到当前协程执行
@@ -109,39 +323,27 @@ void Fiber::swapIn()
     SetThis(this);
     TINY_ASSERT(m_state != State::EXEC);
     m_state = State::EXEC;
-    if (::swapcontext(&(Scheduler::GetMainFiber()->m_context), &m_context))
-    {
-        TINY_ASSERT_P(false, "swapcontext");
-    }
+    SwapContext(Scheduler::GetMainFiber(), this);
 }
 
 //切换到后台执行
 void Fiber::swapOut()
 {
     SetThis(Scheduler::GetMainFiber());
-    if (::swapcontext(&m_context, &(Scheduler::GetMainFiber()->m_context)))
-    {
-        TINY_ASSERT_P(false, "swapcontext");
-    }
+    SwapContext(this, Scheduler::GetMainFiber());
 }
 
 void Fiber::call()
 {
     SetThis(this);
     m_state = State::EXEC;
-    if (::swapcontext(&(t_threadFiber->m_context), &m_context))
-    {
-        TINY_ASSERT_P(false, "swapcontext");
-    }
+    SwapContext(t_threadFiber.get(), this);
 }
 
 void Fiber::back()
 {
     SetThis(t_threadFiber.get());
-    if (::swapcontext(&m_context, &(t_threadFiber->m_context)))
-    {
-        TINY_ASSERT_P(false, "swapcontext");
-    }
+    SwapContext(this, t_threadFiber.get());
 }
 
 
@@ -186,6 +388,16 @@ uint64_t Fiber::TotalFibers()
     return s_fiber_count;
 }
 
+uint64_t Fiber::CacheHits()
+{
+    return s_cache_hit;
+}
+
+uint64_t Fiber::CacheMisses()
+{
+    return s_cache_miss;
+}
+
 void Fiber::MainFunc()
 {
     Ref<Fiber> cur = GetThis();
@@ -230,6 +442,17 @@ void Fiber::CallerMainFunc()
     TINY_ASSERT_P(false, "never reach fiber_id = " + std::to_string(raw_ptr->m_id));
 }
 
+const char* Fiber::ContextBackend()
+{
+#if defined(TINY_FIBER_USE_UCONTEXT)
+    return "ucontext";
+#elif defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+
 uint64_t Fiber::GetFiberId()
 {
     if (t_fiber)
@@ -240,4 +463,4 @@ uint64_t Fiber::GetFiberId()
 }
 
     
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <memory>
 #include <functional>
 #include "log.h"
+#include "fiber_context.h"
 
 namespace TinyServer
 {
@@ -19,7 +20,7 @@ public:
     Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_call = false);
     ~Fiber();
 
-    //重置协程函数，并重置状态
+    //重置协程函数，并重置状态，重新分配id
     //INIT TERM
     void reset(std::function<void()> cb);
 
@@ -37,6 +38,10 @@ public:
     State getState() const { return m_state; }
     void setState(State state) { m_state = state; }
 
+    //协程绑定的线程，不为-1时调度器总是把它放回这个线程执行(reset时清除)
+    int getAffinity() const { return m_affinity; }
+    void setAffinity(int thread) { m_affinity = thread; }
+
 public:
     //设置当前协程
     static void SetThis(Fiber* f);
@@ -48,20 +53,43 @@ public:
     static void YieldToHold();
     //总协程数
     static uint64_t TotalFibers();
+    //协程缓存命中/未命中次数
+    static uint64_t CacheHits();
+    static uint64_t CacheMisses();
+
+    //优先从当前线程的协程缓存中取出已结束的协程reset复用，否则新建
+    static Ref<Fiber> Create(std::function<void()> cb);
+    //已结束且无其他引用的协程放回当前线程缓存，否则直接释放；fiber总会被置空
+    static void Recycle(Ref<Fiber>& fiber);
+    //释放当前线程缓存的协程
+    static void ClearCache();
 
     static void MainFunc();
     static void CallerMainFunc();
 
     static uint64_t GetFiberId();
+    //上下文切换后端名称: ucontext / asm-x86_64 / asm-aarch64
+    static const char* ContextBackend();
 private:
     Fiber();
 
+    //在协程栈上构造初始上下文
+    void initContext(bool use_call);
+    //保存from的上下文并切换到to
+    static void SwapContext(Fiber* from, Fiber* to);
+
 private:
     uint64_t m_id = 0;
     uint32_t m_stacksize = 0;
     State m_state = State::INIT;
+    int m_affinity = -1;
+#ifdef TINY_FIBER_USE_UCONTEXT
     ucontext_t m_context;
+#else
+    void* m_sp = nullptr;   //切出时的栈顶，寄存器保存在协程自己的栈上
+#endif
     void* m_stack = nullptr;
+    bool m_mmapStack = false;   //栈是否由mmap分配(带保护页)
     std::function<void()> m_cb;
 
 };
@@ -0,0 +1,120 @@
+#include "fiber_context.h"
+#include <stdint.h>
+
+#ifndef TINY_FIBER_USE_UCONTEXT
+
+#if defined(__x86_64__)
+//栈布局(低地址->高地址): mxcsr/fpucw | r12 | r13 | r14 | r15 | rbx | rbp | ret
+__asm__(
+    ".text\n"
+    ".globl tiny_swap_context\n"
+    ".type tiny_swap_context,@function\n"
+    ".p2align 4\n"
+    "tiny_swap_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r15\n"
+    "    pushq %r14\n"
+    "    pushq %r13\n"
+    "    pushq %r12\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r12\n"
+    "    popq %r13\n"
+    "    popq %r14\n"
+    "    popq %r15\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size tiny_swap_context,.-tiny_swap_context\n"
+    "\n"
+    ".type tiny_context_entry,@function\n"
+    ".p2align 4\n"
+    "tiny_context_entry:\n"
+    "    callq *%rbx\n"
+    "    ud2\n"
+    ".size tiny_context_entry,.-tiny_context_entry\n"
+);
+#elif defined(__aarch64__)
+//栈布局(低地址->高地址): x19-x28 | x29 | x30 | d8-d15
+__asm__(
+    ".text\n"
+    ".globl tiny_swap_context\n"
+    ".type tiny_swap_context,%function\n"
+    ".p2align 4\n"
+    "tiny_swap_context:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size tiny_swap_context,.-tiny_swap_context\n"
+    "\n"
+    ".type tiny_context_entry,%function\n"
+    ".p2align 4\n"
+    "tiny_context_entry:\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size tiny_context_entry,.-tiny_context_entry\n"
+);
+#endif
+
+extern "C" void tiny_context_entry();
+
+namespace TinyServer
+{
+
+void* MakeFiberContext(void* stack, size_t size, void (*fn)())
+{
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    //tiny_context_entry执行call前rsp需要16字节对齐
+    uint64_t* sp = (uint64_t*)(top - 16 - 64);
+    sp[0] = 0x1f80 | ((uint64_t)0x037f << 32);  //mxcsr和x87控制字的默认值
+    sp[1] = 0;                                  //r12
+    sp[2] = 0;                                  //r13
+    sp[3] = 0;                                  //r14
+    sp[4] = 0;                                  //r15
+    sp[5] = (uint64_t)fn;                       //rbx
+    sp[6] = 0;                                  //rbp
+    sp[7] = (uint64_t)&tiny_context_entry;      //ret
+#elif defined(__aarch64__)
+    uint64_t* sp = (uint64_t*)(top - 160);
+    for (int i = 0; i < 20; ++i)
+        sp[i] = 0;
+    sp[0] = (uint64_t)fn;                       //x19
+    sp[11] = (uint64_t)&tiny_context_entry;     //x30
+#endif
+    return sp;
+}
+
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+
+//协程上下文切换后端
+//默认在x86_64/aarch64上使用手写汇编，只保存callee-saved寄存器
+//定义TINY_FIBER_USE_UCONTEXT(cmake -DTINY_FIBER_USE_UCONTEXT=ON)或其他架构时退回ucontext
+#if !defined(TINY_FIBER_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define TINY_FIBER_USE_UCONTEXT
+#endif
+
+#ifndef TINY_FIBER_USE_UCONTEXT
+
+extern "C"
+{
+//保存当前寄存器到当前栈上，并将栈顶写入*from_sp，然后切换到to_sp所指的上下文
+void tiny_swap_context(void** from_sp, void* to_sp);
+}
+
+namespace TinyServer
+{
+//在[stack, stack + size)上构造初始上下文，首次切入时调用fn，fn不允许返回
+//返回值作为tiny_swap_context的to_sp
+void* MakeFiberContext(void* stack, size_t size, void (*fn)());
+}
+
+#endif
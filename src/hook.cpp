@@ -5,6 +5,8 @@
 #include "fd_manager.h"
 #include "log.h"
 #include "config.h"
+#include "uring.h"
+#include <string.h>
 
 static Ref<TinyServer::Logger> logger = TINY_LOG_NAME("system");
 namespace TinyServer
@@ -30,6 +32,7 @@ static thread_local bool t_hook_enable = false;
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendfile) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -79,8 +82,73 @@ struct timer_info
     int cancelled = 0;
 };
 
+#ifdef TINY_HAVE_IO_URING
+#define URING_OP(name) IORING_OP_ ## name
+#else
+#define URING_OP(name) 0
+#endif
+
+//hook函数对应的io_uring请求，opcode为0表示只走epoll
+struct uring_info
+{
+    int opcode;
+    uint64_t addr;      //buf/iovec/msghdr/sockaddr
+    uint32_t len;       //长度/iovcnt
+    uint64_t off;       //read/write为-1(当前位置)，accept为addrlen指针，connect为addrlen
+    uint32_t flags;     //msg_flags
+};
+
+static uring_info make_uring(int opcode, const void* addr = nullptr, size_t len = 0, uint64_t off = -1, int flags = 0)
+{
+    uring_info info;
+    info.opcode = opcode;
+    info.addr = (uint64_t)(uintptr_t)addr;
+    info.len = (uint32_t)len;
+    info.off = off;
+    info.flags = (uint32_t)flags;
+    return info;
+}
+
+//通过io_uring完成一次操作，结果写入n(失败时为-1并设置errno)
+//返回false表示io_uring不可用或内核返回EAGAIN，调用者继续走epoll
+static bool uring_io(int fd, const Ref<TinyServer::FdCtx>& ctx, const uring_info& info, uint64_t timeout_ms, ssize_t& n)
+{
+#ifdef TINY_HAVE_IO_URING
+    TinyServer::IOManager* iom = TinyServer::IOManager::GetThis();
+    if (!info.opcode || !iom || !iom->hasUring())
+        return false;
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = info.opcode;
+    sqe.fd = fd;
+    sqe.addr = info.addr;
+    sqe.len = info.len;
+    sqe.off = info.off;
+    sqe.msg_flags = info.flags;
+    int res = iom->submitIO(sqe, timeout_ms);
+    if (res == -EAGAIN)
+        return false;
+    if (res >= 0)
+    {
+        n = res;
+        return true;
+    }
+    //被LINK_TIMEOUT或close(cancelAll)取消，fd已经从FdMgr中删除说明是后者
+    if (res == -ECANCELED || res == -EINTR)
+    {
+        res = TinyServer::FdMgr::GetInstance()->get(fd) != ctx ? -EBADF : -ETIMEDOUT;
+    }
+    errno = -res;
+    n = -1;
+    return true;
+#else
+    return false;
+#endif
+}
+
 template<typename OriginalFun, typename ... Args>
-static ssize_t do_io(int fd, OriginalFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, Args&& ...args)
+static ssize_t do_io(int fd, OriginalFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, 
+    const uring_info& uring, Args&& ...args)
 {
     if (!TinyServer::t_hook_enable)
         return fun(fd, std::forward<Args>(args)...);
@@ -100,12 +168,15 @@ static ssize_t do_io(int fd, OriginalFun fun, const char* hook_fun_name, uint32_
         return fun(fd, std::forward<Args>(args)...);
     
     uint64_t to = ctx->getTimeout(timeout_so);
+    ssize_t n = 0;
+    if (uring_io(fd, ctx, uring, to, n))
+        return n;
     std::shared_ptr<timer_info> tinfo(new timer_info);
 retry:
-    ssize_t n = fun(fd, std::forward<Args>(args)...);
+    n = fun(fd, std::forward<Args>(args)...);
     while (n == -1 && errno == EINTR)
     {
-        fun(fd, std::forward<Args>(args)...);
+        n = fun(fd, std::forward<Args>(args)...);
     }
 
     if (n == -1 && errno == EAGAIN)
@@ -212,7 +283,8 @@ int socket(int domain, int type, int protocol)
 
  int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
  {
-    int fd = do_io(s, accept_f, "accept", TinyServer::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    int fd = do_io(s, accept_f, "accept", TinyServer::IOManager::READ, SO_RCVTIMEO, 
+        make_uring(URING_OP(ACCEPT), addr, 0, (uint64_t)(uintptr_t)addrlen), addr, addrlen);
     if (fd >= 0)
     {
         TinyServer::FdMgr::GetInstance()->get(fd, true);
@@ -238,7 +310,12 @@ int socket(int domain, int type, int protocol)
     if (ctx->getUserNonblock())
         return connect_f(sockfd, addr, addrlen);
 
-    int n = connect_f(sockfd, addr, addrlen);
+    //io_uring在内核中等待连接完成，旧内核返回EINPROGRESS时继续走下面的epoll等待
+    ssize_t n = 0;
+    if (!uring_io(sockfd, ctx, make_uring(URING_OP(CONNECT), addr, 0, addrlen), timeout_ms, n))
+    {
+        n = connect_f(sockfd, addr, addrlen);
+    }
     if (n == 0)
     {
         return 0;
@@ -305,53 +382,69 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 
 ssize_t read(int fd, void *buf, size_t count)
 {
-    return do_io(fd, read_f, "read", TinyServer::IOManager::READ, SO_RCVTIMEO, buf, count);
+    return do_io(fd, read_f, "read", TinyServer::IOManager::READ, SO_RCVTIMEO, 
+        make_uring(URING_OP(READ), buf, count), buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
 {
-    return do_io(fd, readv_f, "readv", TinyServer::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    return do_io(fd, readv_f, "readv", TinyServer::IOManager::READ, SO_RCVTIMEO, 
+        make_uring(URING_OP(READV), iov, iovcnt), iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 {
-    return do_io(sockfd, recv_f, "recv", TinyServer::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    return do_io(sockfd, recv_f, "recv", TinyServer::IOManager::READ, SO_RCVTIMEO, 
+        make_uring(URING_OP(RECV), buf, len, 0, flags), buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                         struct sockaddr *src_addr, socklen_t *addrlen)
 {
-    return do_io(sockfd, recvfrom_f, "recvfrom", TinyServer::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", TinyServer::IOManager::READ, SO_RCVTIMEO, 
+        make_uring(0), buf, len, flags, src_addr, addrlen);
 }             
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
 {
-    return do_io(sockfd, recvmsg_f, "recvmsg", TinyServer::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    return do_io(sockfd, recvmsg_f, "recvmsg", TinyServer::IOManager::READ, SO_RCVTIMEO, 
+        make_uring(URING_OP(RECVMSG), msg, 1, 0, flags), msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count)
 {
-    return do_io(fd, write_f, "write", TinyServer::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    return do_io(fd, write_f, "write", TinyServer::IOManager::WRITE, SO_SNDTIMEO, 
+        make_uring(URING_OP(WRITE), buf, count), buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 {
-    return do_io(fd, writev_f, "writev", TinyServer::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    return do_io(fd, writev_f, "writev", TinyServer::IOManager::WRITE, SO_SNDTIMEO, 
+        make_uring(URING_OP(WRITEV), iov, iovcnt), iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags)
 {
-    return do_io(s, send_f, "send", TinyServer::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    return do_io(s, send_f, "send", TinyServer::IOManager::WRITE, SO_SNDTIMEO, 
+        make_uring(URING_OP(SEND), msg, len, 0, flags), msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen)
 {
-    return do_io(s, sendto_f, "sendto", TinyServer::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+    return do_io(s, sendto_f, "sendto", TinyServer::IOManager::WRITE, SO_SNDTIMEO, 
+        make_uring(0), msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags)
 {
-    return do_io(s, sendmsg_f, "sendmsg", TinyServer::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    return do_io(s, sendmsg_f, "sendmsg", TinyServer::IOManager::WRITE, SO_SNDTIMEO, 
+        make_uring(URING_OP(SENDMSG), msg, 1, 0, flags), msg, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    return do_io(out_fd, sendfile_f, "sendfile", TinyServer::IOManager::WRITE, SO_SNDTIMEO, 
+        make_uring(0), in_fd, offset, count);
 }
 
 int close(int fd)
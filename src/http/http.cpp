@@ -1,5 +1,8 @@
 #include "http.h"
+#include "stream.h"
 #include <iostream>
+#include <string.h>
+#include <strings.h>
 
 
 namespace TinyServer
@@ -66,42 +69,44 @@ const char* HttpStatusToString(const HttpStatus& hs)
 }
 
 HttpRequest::HttpRequest(uint8_t version, bool close)
-    : m_method(HttpMethod::GET), m_version(version), m_close(close), m_path("/")
+    : m_method(HttpMethod::GET), m_version(version), m_close(close), m_path("/"), m_parserParamFlag(0)
 {
 
 }
 
 std::string HttpRequest::getHeader(const std::string& key, const std::string& def) const
 {
-    auto iter = m_headers.find(key);
-    return iter == m_headers.end() ? def : iter->second;
+    const StringPiece* v = m_headers.find(key);
+    return v ? v->toString() : def;
 }
 
-std::string HttpRequest::getParma(const std::string& key, const std::string& def) const
+std::string HttpRequest::getParma(const std::string& key, const std::string& def)
 {
-    auto iter = m_params.find(key);
-    return iter == m_params.end() ? def : iter->second;
+    initParam();
+    const StringPiece* v = m_params.find(key);
+    return v ? v->toString() : def;
 }
 
-std::string HttpRequest::getCookie(const std::string& key, const std::string& def) const
+std::string HttpRequest::getCookie(const std::string& key, const std::string& def)
 {
-    auto iter = m_cookies.find(key);
-    return iter == m_cookies.end() ? def : iter->second;
+    initCookies();
+    const StringPiece* v = m_cookies.find(key);
+    return v ? v->toString() : def;
 }
 
 void HttpRequest::setHeader(const std::string& key, const std::string& val)
 {
-    m_headers[key] = val;
+    m_headers.set(key, val);
 }
 
 void HttpRequest::setParam(const std::string& key, const std::string& val)
 {
-    m_params[key] = val;
+    m_params.set(key, val);
 }
 
 void HttpRequest::setCookie(const std::string& key, const std::string& val)
 {
-    m_cookies[key] = val;
+    m_cookies.set(key, val);
 }
 
 void HttpRequest::delHeader(const std::string& key)
@@ -111,56 +116,189 @@ void HttpRequest::delHeader(const std::string& key)
 
 void HttpRequest::delParam(const std::string& key)
 {
+    initParam();
     m_params.erase(key);
 }
 
 void HttpRequest::delCookie(const std::string& key)
 {
+    initCookies();
     m_cookies.erase(key);
 }
 
 bool HttpRequest::hasHeader(const std::string& key, std::string* val)
 {
-    auto iter = m_headers.find(key);
-    if (iter == m_headers.end())
+    const StringPiece* v = m_headers.find(key);
+    if (!v)
     {
         return false;
     }
-    else
+    else if (val)
     {
-        *val = iter->second;
+        *val = v->toString();
     }
     return true;
 }
 
 bool HttpRequest::hasParam(const std::string& key, std::string* val)
 {
-    auto iter = m_params.find(key);
-    if (iter == m_params.end())
+    initParam();
+    const StringPiece* v = m_params.find(key);
+    if (!v)
     {
         return false;
     }
-    else
+    else if (val)
     {
-        *val = iter->second;
+        *val = v->toString();
     }
     return true;
 }
 
 bool HttpRequest::hasCookie(const std::string& key, std::string* val)
 {
-    auto iter = m_cookies.find(key);
-    if (iter == m_cookies.end())
+    initCookies();
+    const StringPiece* v = m_cookies.find(key);
+    if (!v)
     {
         return false;
     }
-    else
+    else if (val)
     {
-        *val = iter->second;
+        *val = v->toString();
     }
     return true;
 }
 
+const std::string& HttpRequest::getBody()
+{
+    if (m_bodyStream)
+    {
+        Ref<Stream> stream = m_bodyStream;
+        m_bodyStream.reset();
+        static const size_t s_read_size = 64 * 1024;
+        while (true)
+        {
+            size_t offset = m_body.size();
+            m_body.resize(offset + s_read_size);
+            int len = stream->read(&m_body[offset], s_read_size);
+            m_body.resize(offset + (len > 0 ? len : 0));
+            if (len <= 0)
+                break;
+        }
+    }
+    return m_body;
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+//原地百分号解码，plus为true时'+'解码为空格(x-www-form-urlencoded)，返回解码后的长度
+//不完整或不合法的%xx原样保留
+static size_t UrlDecodeInPlace(char* str, size_t len, bool plus)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < len; ++i, ++out)
+    {
+        int hi, lo;
+        if (str[i] == '%' && i + 2 < len && (hi = HexValue(str[i + 1])) >= 0 && (lo = HexValue(str[i + 2])) >= 0)
+        {
+            str[out] = (char)(hi << 4 | lo);
+            i += 2;
+        }
+        else if (plus && str[i] == '+')
+            str[out] = ' ';
+        else
+            str[out] = str[i];
+    }
+    return out;
+}
+
+//按sep切分出k=v，复制到map的arena中原地解码后加入，已存在的key不覆盖(先出现的优先)
+//trim为true时去掉名字和值两边的空格(Cookie头部"a=1; b=2")
+static void ParseUrlFields(HttpFieldMap& map, const char* data, size_t len, char sep, bool plus, bool trim)
+{
+    const char* end = data + len;
+    while (data < end)
+    {
+        const char* item = data;
+        const char* item_end = (const char*)memchr(data, sep, end - data);
+        if (!item_end)
+            item_end = end;
+        data = item_end + 1;
+        if (trim)
+        {
+            while (item < item_end && *item == ' ')
+                ++item;
+            while (item_end > item && item_end[-1] == ' ')
+                --item_end;
+        }
+        const char* eq = (const char*)memchr(item, '=', item_end - item);
+        const char* val = eq ? eq + 1 : item_end;
+        size_t klen = (eq ? eq : item_end) - item;
+        if (trim)
+        {
+            while (klen > 0 && item[klen - 1] == ' ')
+                --klen;
+            while (val < item_end && *val == ' ')
+                ++val;
+        }
+        size_t vlen = item_end - val;
+        if (klen == 0)
+            continue;
+        char* key = map.getArena().alloc(klen + vlen);
+        char* value = key + klen;
+        memcpy(key, item, klen);
+        memcpy(value, val, vlen);
+        map.add(key, UrlDecodeInPlace(key, klen, plus), value, UrlDecodeInPlace(value, vlen, plus), false);
+    }
+}
+
+void HttpRequest::initParam()
+{
+    initQueryParam();
+    initBodyParam();
+}
+
+void HttpRequest::initQueryParam()
+{
+    if (m_parserParamFlag & 0x1)
+        return;
+    m_parserParamFlag |= 0x1;
+    ParseUrlFields(m_params, m_query.data(), m_query.size(), '&', true, false);
+}
+
+void HttpRequest::initBodyParam()
+{
+    if (m_parserParamFlag & 0x2)
+        return;
+    m_parserParamFlag |= 0x2;
+    static const char s_form[] = "application/x-www-form-urlencoded";
+    const StringPiece* type = m_headers.find(HttpHeader::CONTENT_TYPE);
+    if (!type || type->size < sizeof(s_form) - 1 || strncasecmp(type->data, s_form, sizeof(s_form) - 1) != 0)
+        return;
+    const std::string& body = getBody();
+    ParseUrlFields(m_params, body.data(), body.size(), '&', true, false);
+}
+
+void HttpRequest::initCookies()
+{
+    if (m_parserParamFlag & 0x4)
+        return;
+    m_parserParamFlag |= 0x4;
+    const StringPiece* cookie = m_headers.find(HttpHeader::COOKIE);
+    if (!cookie)
+        return;
+    ParseUrlFields(m_cookies, cookie->data, cookie->size, ';', false, true);
+}
+
 std::ostream& HttpRequest::dump(std::ostream& os) const
 {
     //GET /uri HTTP/1.1
@@ -170,11 +308,11 @@ std::ostream& HttpRequest::dump(std::ostream& os) const
        << " HTTP/" << (uint32_t)(m_version >> 4)  << "." << (uint32_t)(m_version & 0x0F)
        << "\r\n";
     os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
-    for (auto& item : m_headers)
+    for (auto it = m_headers.begin(); it != m_headers.end(); ++it)
     {
-        if (strcasecmp(item.first.c_str(), "connection") == 0)
+        if (it.header() == HttpHeader::CONNECTION)
             continue;
-        os << item.first << ": " << item.second << "\r\n";
+        os << it->key << ": " << it->value << "\r\n";
     }
     if (!m_body.empty())
     {
@@ -200,13 +338,13 @@ HttpResponse::HttpResponse(uint8_t version, bool close)
 
 std::string HttpResponse::getHeader(const std::string& key, const std::string& def)
 {
-    auto iter = m_headers.find(key);
-    return iter == m_headers.end() ? def : iter->second;
+    const StringPiece* v = m_headers.find(key);
+    return v ? v->toString() : def;
 }
 
 void HttpResponse::setHeader(const std::string& key, const std::string& val)
 {
-    m_headers[key] = val;
+    m_headers.set(key, val);
 }
 
 void HttpResponse::delHeader(const std::string& key)
@@ -214,27 +352,74 @@ void HttpResponse::delHeader(const std::string& key)
     m_headers.erase(key);
 }
 
-std::ostream& HttpResponse::dump(std::ostream& os) const
+static void AppendNumber(std::string& out, uint64_t value)
 {
-    os << "HTTP/" << ((uint32_t)(m_version >> 4)) << "." << ((uint32_t)(m_version & 0x0f)) << " "
-       << (uint32_t)m_status << " " << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
-       << "\r\n";
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out.append(p, end - p);
+}
 
-    for (auto& item : m_headers)
+//keep-alive时客户端靠content-length确定响应结束，空body也要带上(1xx/204/304除外)
+void HttpResponse::dumpHead(std::string& out) const
+{
+    out.append("HTTP/");
+    out.push_back('0' + (m_version >> 4));
+    out.push_back('.');
+    out.push_back('0' + (m_version & 0x0f));
+    out.push_back(' ');
+    AppendNumber(out, (uint32_t)m_status);
+    out.push_back(' ');
+    out.append(m_reason.empty() ? HttpStatusToString(m_status) : m_reason.c_str());
+    out.append("\r\n");
+
+    for (auto it = m_headers.begin(); it != m_headers.end(); ++it)
     {
-        if (strcasecmp(item.first.c_str(), "connection") == 0)
+        if (it.header() == HttpHeader::CONNECTION)
+        {
+            continue;
+        }
+        //流式响应的分帧由下面的transfer-encoding决定，忽略用户设置的长度和编码
+        if (m_bodyStream && (it.header() == HttpHeader::CONTENT_LENGTH 
+            || it.header() == HttpHeader::TRANSFER_ENCODING))
         {
             continue;
         }
-        os << item.first << ": " << item.second << "\r\n";
+        out.append(it->key.data, it->key.size);
+        out.append(": ");
+        out.append(it->value.data, it->value.size);
+        out.append("\r\n");
     }
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+    out.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
 
-    if (!m_body.empty())
-        os << "content-length: " << m_body.size() << "\r\n\r\n" << m_body;
-    else
-        os << "\r\n";
-    return os;
+    uint64_t length = getBodyLength();
+    uint32_t status = (uint32_t)m_status;
+    if (m_bodyStream)
+    {
+        //HTTP/1.0不支持chunked，body以关闭连接结束
+        if (m_version >= 0x11)
+            out.append("transfer-encoding: chunked\r\n");
+    }
+    //显式设置的content-length(如HEAD响应)优先
+    else if (!m_headers.find(HttpHeader::CONTENT_LENGTH) && (length > 0 || (status >= 200 && status != 204 && status != 304)))
+    {
+        out.append("content-length: ");
+        AppendNumber(out, length);
+        out.append("\r\n");
+    }
+    out.append("\r\n");
+}
+
+std::ostream& HttpResponse::dump(std::ostream& os) const
+{
+    std::string head;
+    dumpHead(head);
+    return os << head << getBody();
 }
 
 std::string HttpResponse::toString() const
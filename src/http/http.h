@@ -2,9 +2,12 @@
 #include <memory>
 #include <boost/lexical_cast.hpp>
 #include <map>
+#include "http/http_fields.h"
 
 namespace TinyServer
 {
+class Stream;
+
 namespace http
 {
     /* Request Methods */
@@ -140,18 +143,18 @@ struct CaseInsensitiveLess
     bool operator()(const std::string& lhs, const std::string& rhs) const;
 };
 
-template<typename MapType, typename T>
-    bool checkGetAs(const MapType& m, const std::string& key, T& val, const T& def = T())
+template<typename MapType, typename KeyType, typename T>
+    bool checkGetAs(const MapType& m, const KeyType& key, T& val, const T& def = T())
     {
-        auto iter = m.find(key);
-        if (iter == m.end())
+        const StringPiece* v = m.find(key);
+        if (!v)
         {
             val = def;
             return false;
         }
         try
         {
-            val = boost::lexical_cast<T>(iter->second);
+            val = boost::lexical_cast<T>(v->data, v->size);
             return true;
         }
         catch(...)
@@ -161,17 +164,17 @@ template<typename MapType, typename T>
         return false;
     }
 
-    template<typename MapType, typename T>
-    T getAs(const MapType& m, const std::string& key, const T& def = T())
+    template<typename MapType, typename KeyType, typename T>
+    T getAs(const MapType& m, const KeyType& key, const T& def = T())
     {
-        auto iter = m.find(key);
-        if (iter == m.end())
+        const StringPiece* v = m.find(key);
+        if (!v)
         {
             return def;
         }
         try
         {
-            return boost::lexical_cast<T>(iter->second);
+            return boost::lexical_cast<T>(v->data, v->size);
         }
         catch(...)
         {
@@ -181,10 +184,14 @@ template<typename MapType, typename T>
     }
 //uri: http://www.baidu.com:80/page/xxx?id=10&v=20#fr
 //http==协议 www.baidu.com==host 80==端口 /page/xxx==path id=10&v=20==param fr==fragment
+//头部、参数和cookie都存放在扁平数组+arena中，解析时每个头部不再单独申请内存
+//常用头部(HTTP_HEADER_MAP)可以用HttpHeader枚举O(1)访问
+//参数(query和x-www-form-urlencoded的body)与cookie在第一次访问时才解析，不访问的请求没有开销
 class HttpRequest
 {
 public:
-    typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
+    typedef HttpFieldMap MapType;
+    typedef HttpHeaderMap HeaderMapType;
     HttpRequest(uint8_t version = 0x11, bool close = true);
 
     HttpMethod getMethod() const { return m_method; }
@@ -192,11 +199,14 @@ public:
     uint8_t getVersion() const { return m_version; }
     const std::string& getPath() { return m_path; }
     const std::string& getQuery() { return m_query; }
-    const std::string& getBody() { return m_body; }
+    //body通过getBodyStream流式读取时，第一次调用会把剩下的部分全部读入
+    const std::string& getBody();
+    //较大的body不会预先读入，servlet通过这个Stream分块读取，读完后read返回0
+    std::shared_ptr<Stream> getBodyStream() const { return m_bodyStream; }
 
-    const MapType& getHeaders() { return m_headers; }
-    const MapType& getParams() { return m_params; }
-    const MapType& getCookies() { return m_cookies; }
+    const HeaderMapType& getHeaders() { return m_headers; }
+    const MapType& getParams() { initParam(); return m_params; }
+    const MapType& getCookies() { initCookies(); return m_cookies; }
 
     void setMethod(HttpMethod v) { m_method = v; }
     void setStatus(HttpStatus v) { m_status = v; }
@@ -205,16 +215,28 @@ public:
     void setQuery(const std::string& query) { m_query = query; }
     void setFragment(const std::string& f) { m_fragment = f; }
     void setBody(const std::string& body) { m_body = body; }
+    void setBodyStream(std::shared_ptr<Stream> v) { m_bodyStream = v; }
 
-    void setHeaders(const MapType& v) { m_headers = v; }
+    void setHeaders(const HeaderMapType& v) { m_headers = v; }
     void setParams(const MapType& v) { m_params = v; }
     void setCookies(const MapType& v) { m_cookies = v; }
 
     std::string getHeader(const std::string& key, const std::string& def = "") const;
-    std::string getParma(const std::string& key, const std::string& def = "") const;
-    std::string getCookie(const std::string& key, const std::string& def = "") const;
+    std::string getParma(const std::string& key, const std::string& def = "");
+    std::string getCookie(const std::string& key, const std::string& def = "");
 
     void setHeader(const std::string& key, const std::string& val);
+    //解析器直接传入缓冲中的字段，不构造std::string
+    void setHeader(const char* key, size_t klen, const char* val, size_t vlen) { m_headers.set(key, klen, val, vlen); }
+    void setHeader(HttpHeader key, const std::string& val) { m_headers.set(key, val.data(), val.size()); }
+    //常用头部，不存在返回nullptr，返回的指针在修改头部前有效
+    const StringPiece* findHeader(HttpHeader key) const { return m_headers.find(key); }
+    std::string getHeader(HttpHeader key, const std::string& def = "") const
+    {
+        const StringPiece* v = m_headers.find(key);
+        return v ? v->toString() : def;
+    }
+    //setParam/setCookie设置的值优先于之后解析出的同名参数/cookie
     void setParam(const std::string& key, const std::string& val);
     void setCookie(const std::string& key, const std::string& val);
 
@@ -230,7 +252,7 @@ public:
     void setClose(bool v) { m_close = v; }
 
     template<typename T>
-    bool checkHeaderAs(const std::string& key, T& val, T& def = T())
+    bool checkHeaderAs(const std::string& key, T& val, const T& def = T())
     {
         return checkGetAs(m_headers, key, val, def);
     }
@@ -242,32 +264,49 @@ public:
     }
 
     template<typename T>
-    bool checkParamAs(const std::string& key, T& val, T& def = T())
+    T getHeaderAs(HttpHeader key, const T& def = T())
     {
-        return checkGetAs(m_headers, key, val, def);
+        return getAs(m_headers, key, def);
     }
 
     template<typename T>
-    T getParamAs(const std::string& key, T& def = T())
+    bool checkParamAs(const std::string& key, T& val, const T& def = T())
     {
-        return getAs(m_headers, key, def);
+        initParam();
+        return checkGetAs(m_params, key, val, def);
     }
 
     template<typename T>
-    bool checkCookieAs(const std::string& key, T& val, T& def = T())
+    T getParamAs(const std::string& key, const T& def = T())
     {
-        return checkGetAs(m_headers, key, val, def);
+        initParam();
+        return getAs(m_params, key, def);
     }
 
     template<typename T>
-    T getCookieAs(const std::string& key, T& def = T())
+    bool checkCookieAs(const std::string& key, T& val, const T& def = T())
     {
-        return getAs(m_headers, key, def);
+        initCookies();
+        return checkGetAs(m_cookies, key, val, def);
+    }
+
+    template<typename T>
+    T getCookieAs(const std::string& key, const T& def = T())
+    {
+        initCookies();
+        return getAs(m_cookies, key, def);
     }
 
     std::ostream& dump(std::ostream& os) const;
     std::string toString() const;
 
+private:
+    void initParam();
+    void initQueryParam();
+    //content-type为application/x-www-form-urlencoded时解析body
+    void initBodyParam();
+    void initCookies();
+
 private:
     HttpMethod m_method;
     HttpStatus m_status;
@@ -278,40 +317,67 @@ private:
     std::string m_query;
     std::string m_fragment;
     std::string m_body;
+    std::shared_ptr<Stream> m_bodyStream;
+
+    HeaderMapType m_headers;
+    MapType m_params;
+    MapType m_cookies;
+    //已经解析过的部分: 0x1 query, 0x2 body, 0x4 cookie
+    uint8_t m_parserParamFlag;
+};
 
-    std::map<std::string, std::string, CaseInsensitiveLess> m_headers;
-    std::map<std::string, std::string, CaseInsensitiveLess> m_params;
-    std::map<std::string, std::string, CaseInsensitiveLess> m_cookies;
+//用sendfile发送的文件区间，holder保证发送完之前fd不会被关闭
+struct HttpFileBody
+{
+    std::shared_ptr<const void> holder;
+    int fd = -1;
+    uint64_t offset = 0;
+    uint64_t length = 0;
 };
 
 class HttpResponse
 {
 public:
-    typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
+    typedef HttpHeaderMap MapType;
 
     HttpResponse(uint8_t version = 0x11, bool close = true);
 
     HttpStatus getStatus() const { return m_status; }
     uint8_t getVersion() const { return m_version; }
-    const std::string& getBody() { return m_body; }
+    const std::string& getBody() const { return m_sharedBody ? *m_sharedBody : m_body; }
     const std::string& getReason() { return m_reason; }
     const MapType& getHeaders() const { return m_headers; }
 
     void setStatus(HttpStatus v) { m_status = v; }
     void setVersion(uint8_t version) { m_version = version; }
-    void setBody(const std::string& v) { m_body = v; }
+    void setBody(const std::string& v) { m_body = v; m_sharedBody.reset(); }
+    void setBody(std::string&& v) { m_body = std::move(v); m_sharedBody.reset(); }
+    //共享的不可变body(如缓存的静态内容、预先生成的json)，多个响应共用，发送时不拷贝
+    void setBody(std::shared_ptr<const std::string> v) { m_body.clear(); m_sharedBody = v; }
     void setReason(const std::string& v) { m_reason = v; }
     void setHeaders(const MapType& v) { m_headers = v; }
 
+    //body是文件的一部分，由HttpSession用sendfile发送，设置后忽略字符串body
+    std::shared_ptr<const HttpFileBody> getFileBody() const { return m_fileBody; }
+    void setFileBody(std::shared_ptr<const HttpFileBody> v) { m_fileBody = v; }
+    //body的长度(content-length)
+    uint64_t getBodyLength() const { return m_fileBody ? m_fileBody->length : getBody().size(); }
+    //流式响应(HttpSession::beginChunked)的body，头部发出后由servlet边生成边写
+    std::shared_ptr<Stream> getBodyStream() const { return m_bodyStream; }
+    void setBodyStream(std::shared_ptr<Stream> v) { m_bodyStream = v; }
+
     bool isColse() const { return m_close; }
     void setClose(bool v) { m_close = v; }
 
     std::string getHeader(const std::string& key, const std::string& def = "");
     void setHeader(const std::string& key, const std::string& val);
+    void setHeader(const char* key, size_t klen, const char* val, size_t vlen) { m_headers.set(key, klen, val, vlen); }
+    void setHeader(HttpHeader key, const std::string& val) { m_headers.set(key, val.data(), val.size()); }
+    const StringPiece* findHeader(HttpHeader key) const { return m_headers.find(key); }
     void delHeader(const std::string& key);
 
     template<typename T>
-    bool checkHeaderAs(const std::string& key, T& val, T& def = T())
+    bool checkHeaderAs(const std::string& key, T& val, const T& def = T())
     {
         return checkGetAs(m_headers, key, val, def);
     }
@@ -323,29 +389,13 @@ public:
     }
 
     template<typename T>
-    bool checkParamAs(const std::string& key, T& val, T& def = T())
-    {
-        return checkGetAs(m_headers, key, val, def);
-    }
-
-    template<typename T>
-    T getParamAs(const std::string& key, T& def = T())
-    {
-        return getAs(m_headers, key, def);
-    }
-
-    template<typename T>
-    bool checkCookieAs(const std::string& key, T& val, T& def = T())
-    {
-        return checkGetAs(m_headers, key, val, def);
-    }
-
-    template<typename T>
-    T getCookieAs(const std::string& key, T& def = T())
+    T getHeaderAs(HttpHeader key, const T& def = T())
     {
         return getAs(m_headers, key, def);
     }
 
+    //状态行和头部(以空行结束)追加到out，不包括body
+    void dumpHead(std::string& out) const;
     std::ostream& dump(std::ostream& os) const;
     std::string toString() const;
 private:
@@ -354,6 +404,9 @@ private:
     bool m_close;
 
     std::string m_body;
+    std::shared_ptr<const std::string> m_sharedBody;
+    std::shared_ptr<const HttpFileBody> m_fileBody;
+    std::shared_ptr<Stream> m_bodyStream;
     std::string m_reason;
     MapType m_headers;
 };
@@ -1,6 +1,8 @@
 #include "http_connection.h"
 #include "http/http_parser.h"
 #include "log.h"
+#include "config.h"
+#include <algorithm>
 #include <functional>
 
 namespace TinyServer
@@ -9,6 +11,18 @@ namespace http
 {
 static Ref<Logger> logger = TINY_LOG_NAME("system");
 
+static Ref<ConfigVar<uint32_t>> http_pool_shards = 
+    Config::Lookup("http.connection_pool.shards", (uint32_t)0, "http connection pool shard count, 0 means one per iomanager thread"); 
+
+static Ref<ConfigVar<uint32_t>> http_pool_max_connecting = 
+    Config::Lookup("http.connection_pool.max_connecting", (uint32_t)4, "http connection pool concurrent connects per shard"); 
+
+static Ref<ConfigVar<uint64_t>> http_pool_max_idle_time = 
+    Config::Lookup("http.connection_pool.max_idle_time", (uint64_t)30 * 1000, "http connection pool idle connection timeout ms"); 
+
+static Ref<ConfigVar<uint64_t>> http_pool_dns_ttl = 
+    Config::Lookup("http.connection_pool.dns_ttl", (uint64_t)60 * 1000, "http connection pool dns cache ms"); 
+
 std::string HttpResult::toString() const
 {
     std::stringstream ss;
@@ -65,15 +79,20 @@ Ref<HttpResponse> HttpConnection::recvResponse()
         int len = offset;
         do
         {
+            //缓冲中剩下的数据可能已经包含下一个chunk头，先解析再读
+            bool begin = true;
             do
             {
-                int res = read(data + len, buffer_size - len);
-                if (res <= 0)
+                if (!begin || len == 0)
                 {
-                    close();
-                    return nullptr;
+                    int res = read(data + len, buffer_size - len);
+                    if (res <= 0)
+                    {
+                        close();
+                        return nullptr;
+                    }
+                    len += res;
                 }
-                len += res;
                 data[len] = '\0';
                 size_t nparse = parser->execute(data, len, true);
                 if (parser->hasError())
@@ -81,18 +100,19 @@ Ref<HttpResponse> HttpConnection::recvResponse()
                 len -= nparse;
                 if (len == (int)buffer_size)
                     return nullptr;
+                begin = false;
             } while (!parser->isFinished());
-            len -= 2;
-            if (client_parser.content_len <= len)
+            //chunk数据后面跟着\r\n
+            if (client_parser.content_len + 2 <= len)
             {
                 body.append(data, client_parser.content_len);
-                memmove(data, data + client_parser.content_len, len - client_parser.content_len);
-                len -= client_parser.content_len;
+                memmove(data, data + client_parser.content_len + 2, len - client_parser.content_len - 2);
+                len -= client_parser.content_len + 2;
             }
             else
             {
                 body.append(data, len);
-                int left = client_parser.content_len - len;
+                int left = client_parser.content_len - len + 2;
                 while (left > 0)
                 {
                     int res = read(data, left > (int)buffer_size ? (int)buffer_size : left);
@@ -104,6 +124,7 @@ Ref<HttpResponse> HttpConnection::recvResponse()
                     body.append(data, res);
                     left -= res;
                 }
+                body.resize(body.size() - 2);
                 len = 0;
             }
         } while (!client_parser.chunks_done);  
@@ -297,78 +318,282 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host, const std::strin
                                         uint32_t maxAliveTime, uint32_t maxRequest)
     : m_host(host), m_vhost(vhost), m_port(port), m_maxSize(maxSize), m_maxAliveTime(maxAliveTime), m_maxRequest(maxRequest)                                    
 {
+    uint32_t count = http_pool_shards->getValue();
+    if (count == 0)
+    {
+        IOManager* iom = IOManager::GetThis();
+        count = iom ? iom->getThreadIds().size() : 1;
+    }
+    //每个分片至少能有一个连接
+    count = std::max(1u, std::min(count, std::max(1u, m_maxSize)));
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Ref<Shard> shard(new Shard);
+        shard->maxSize = std::max(1u, m_maxSize / count + (i < m_maxSize % count ? 1 : 0));
+        m_shards.push_back(shard);
+    }
+}
 
+HttpConnectionPool::~HttpConnectionPool()
+{
+    for (auto& shard : m_shards)
+    {
+        for (auto& conn : shard->idle)
+        {
+            delete conn;
+        }
+    }
 }
 
+HttpConnectionPool::Shard& HttpConnectionPool::getShard()
+{
+    IOManager* iom = IOManager::GetThis();
+    if (iom && m_shards.size() > 1)
+    {
+        const std::vector<int>& ids = iom->getThreadIds();
+        auto it = std::find(ids.begin(), ids.end(), GetThreadId());
+        if (it != ids.end())
+            return *m_shards[(it - ids.begin()) % m_shards.size()];
+    }
+    return *m_shards[0];
+}
 
-Ref<HttpConnection> HttpConnectionPool::getConnection()
+HttpConnection* HttpConnectionPool::stealIdle(Shard& self, Shard*& from, uint64_t now)
 {
-    uint64_t currentMS = GetCurrentMs();
-    std::vector<HttpConnection*> invalid_conns;
-    HttpConnection* ptr = nullptr;
-    MutexType::MutexLockGuard lock(m_mutex);
-    while (!m_conns.empty())
+    uint64_t max_idle = http_pool_max_idle_time->getValue();
+    for (auto& item : m_shards)
     {
-        auto conn = *m_conns.begin();
-        m_conns.pop_front();
-        if (!conn->isConnected())
-        {
-            invalid_conns.push_back(conn);
+        Shard* shard = item.get();
+        if (shard == &self)
             continue;
+        std::vector<HttpConnection*> invalid_conns;
+        HttpConnection* ptr = nullptr;
+        MutexType::MutexLockGuard lock(shard->mutex);
+        while (!ptr && !shard->idle.empty())
+        {
+            HttpConnection* conn = shard->idle.front();
+            shard->idle.pop_front();
+            if (!conn->isConnected() || isExpired(conn, now) || now >= conn->m_lastUseTime + max_idle)
+                invalid_conns.push_back(conn);
+            else
+                ptr = conn;
         }
-        if (conn->m_createTime >= currentMS)
+        shard->total -= invalid_conns.size();
+        for (size_t i = 0; i < invalid_conns.size(); ++i)
         {
-            invalid_conns.push_back(conn);
-            continue;
+            if (!WakeOne(*shard, nullptr))
+                break;
+        }
+        lock.unlock();
+        for (auto& conn : invalid_conns)
+        {
+            delete conn;
+        }
+        if (ptr)
+        {
+            from = shard;
+            return ptr;
         }
-        ptr = conn;
-        break;
     }
-    lock.unlock();
-    for (auto& item : invalid_conns)
+    return nullptr;
+}
+
+bool HttpConnectionPool::isExpired(HttpConnection* conn, uint64_t now) const
+{
+    return m_maxAliveTime && now >= conn->m_createTime + m_maxAliveTime;
+}
+
+Ref<IPAddress> HttpConnectionPool::getAddress()
+{
+    uint64_t now = GetCurrentMs();
     {
-        delete item;
+        MutexType::MutexLockGuard lock(m_addrMutex);
+        if (m_addr && now < m_addrTime + http_pool_dns_ttl->getValue())
+            return m_addr;
     }
-    m_total -= invalid_conns.size();
-    if (!ptr)
+    Ref<IPAddress> addr = Address::LookupIPAddress(m_host);
+    if (!addr)
     {
-        Ref<IPAddress> addr = Address::LookupIPAddress(m_host);
-        if (!addr)
+        TINY_LOG_ERROR(logger) << "get addr fail: " << m_host;
+        return nullptr;
+    }
+    addr->setPort(m_port);
+    MutexType::MutexLockGuard lock(m_addrMutex);
+    m_addr = addr;
+    m_addrTime = now;
+    return addr;
+}
+
+HttpConnection* HttpConnectionPool::createConnection(uint64_t timeout_ms)
+{
+    Ref<IPAddress> addr = getAddress();
+    if (!addr)
+        return nullptr;
+    Ref<Socket> sock = Socket::CreateTCP(addr);
+    if (!sock)
+    {
+        TINY_LOG_ERROR(logger) << "create socket fail: " << *addr;
+        return nullptr;
+    }
+    if (!sock->connect(addr, timeout_ms))
+    {
+        TINY_LOG_ERROR(logger) << "sock connect fail" << *addr;
+        //地址可能已经变化，下次重新解析
+        MutexType::MutexLockGuard lock(m_addrMutex);
+        if (m_addr == addr)
+            m_addr.reset();
+        return nullptr;
+    }
+    HttpConnection* conn = new HttpConnection(sock);
+    conn->m_createTime = GetCurrentMs();
+    return conn;
+}
+
+Ref<HttpConnection> HttpConnectionPool::wrap(HttpConnection* ptr, Shard* shard)
+{
+    return Ref<HttpConnection>(ptr, std::bind(&HttpConnectionPool::ReleasePtr, std::placeholders::_1, this, shard));
+}
+
+bool HttpConnectionPool::WakeOne(Shard& shard, HttpConnection* conn)
+{
+    if (shard.waiters.empty())
+        return false;
+    Ref<Waiter> waiter = shard.waiters.front();
+    shard.waiters.pop_front();
+    waiter->conn = conn;
+    waiter->done = true;
+    waiter->iom->schedule(waiter->fiber);
+    return true;
+}
+
+Ref<HttpConnection> HttpConnectionPool::getConnection(uint64_t timeout_ms)
+{
+    Shard& shard = getShard();
+    uint64_t deadline = GetCurrentMs() + timeout_ms;
+    //等待前先看其他分片有没有空闲连接
+    bool stolen = m_shards.size() == 1;
+    while (true)
+    {
+        uint64_t now = GetCurrentMs();
+        uint64_t max_idle = http_pool_max_idle_time->getValue();
+        std::vector<HttpConnection*> invalid_conns;
+        HttpConnection* ptr = nullptr;
+        bool need_connect = false;
+        bool need_steal = false;
+        Ref<Waiter> waiter;
+        MutexType::MutexLockGuard lock(shard.mutex);
+        //最久没用的在后面，空闲太久的连接很可能已经被对端关闭
+        while (!shard.idle.empty() && now >= shard.idle.back()->m_lastUseTime + max_idle)
         {
-            TINY_LOG_ERROR(logger) << "get addr fail: " << m_host;
-            return nullptr;
+            invalid_conns.push_back(shard.idle.back());
+            shard.idle.pop_back();
         }
-        addr->setPort(m_port);
-        Ref<Socket> sock = Socket::CreateTCP(addr);
-        if (!sock)
+        while (!ptr && !shard.idle.empty())
         {
-            TINY_LOG_ERROR(logger) << "create socket fail: " << *addr;
-            return nullptr;
+            HttpConnection* conn = shard.idle.front();
+            shard.idle.pop_front();
+            if (!conn->isConnected() || isExpired(conn, now))
+                invalid_conns.push_back(conn);
+            else
+                ptr = conn;
         }
-        if (!sock->connect(addr))
+        shard.total -= invalid_conns.size();
+        //空出的名额让给等待者
+        for (size_t i = 0; i < invalid_conns.size(); ++i)
         {
-            TINY_LOG_ERROR(logger) << "sock connect fail" << *addr;
+            if (!WakeOne(shard, nullptr))
+                break;
+        }
+        if (!ptr)
+        {
+            if (shard.total < shard.maxSize && shard.connecting < http_pool_max_connecting->getValue())
+            {
+                ++shard.total;
+                ++shard.connecting;
+                need_connect = true;
+            }
+            else if (!stolen)
+            {
+                need_steal = true;
+            }
+            else if (now < deadline && IOManager::GetThis())
+            {
+                waiter.reset(new Waiter);
+                waiter->fiber = Fiber::GetThis();
+                waiter->iom = IOManager::GetThis();
+                shard.waiters.push_back(waiter);
+            }
+        }
+        lock.unlock();
+        for (auto& item : invalid_conns)
+        {
+            delete item;
+        }
+
+        if (ptr)
+            return wrap(ptr, &shard);
+        if (need_connect)
+        {
+            ptr = createConnection(deadline > now ? deadline - now : 1);
+            lock.lock();
+            --shard.connecting;
+            if (!ptr)
+                --shard.total;
+            WakeOne(shard, nullptr);
+            lock.unlock();
+            return ptr ? wrap(ptr, &shard) : nullptr;
+        }
+        if (need_steal)
+        {
+            //连接仍归还到它原来的分片
+            Shard* from = nullptr;
+            ptr = stealIdle(shard, from, now);
+            if (ptr)
+                return wrap(ptr, from);
+            stolen = true;
+            continue;
+        }
+        if (!waiter)
+        {
+            TINY_LOG_WARN(logger) << "connection pool exhausted: " << m_host << ":" << m_port
+                << " max_size = " << m_maxSize;
             return nullptr;
         }
-        ptr = new HttpConnection(sock);
-        ++m_total;
+        Shard* pshard = &shard;
+        Ref<Timer> timer = waiter->iom->addTimer(deadline - now, [pshard, waiter](){
+            MutexType::MutexLockGuard lock(pshard->mutex);
+            if (waiter->done)
+                return;
+            pshard->waiters.remove(waiter);
+            waiter->done = true;
+            waiter->iom->schedule(waiter->fiber);
+        });
+        Fiber::YieldToHold();
+        timer->cancle();
+        if (waiter->conn)
+            return wrap(waiter->conn, &shard);
+        stolen = m_shards.size() == 1;
     }
-    return Ref<HttpConnection>(ptr, std::bind(&HttpConnectionPool::ReleasePtr, std::placeholders::_1, this));
 }
 
-void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool)
+void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool, Shard* shard)
 {
     ++ptr->m_request;
-    //Bug: 最大存活时间无效
-    if (!ptr->isConnected() || ((ptr->m_createTime + pool->m_maxAliveTime) >= GetCurrentMs())
-        || ptr->m_request > pool->m_maxRequest)
+    uint64_t now = GetCurrentMs();
+    ptr->m_lastUseTime = now;
+    bool invalid = !ptr->isConnected() || pool->isExpired(ptr, now)
+        || (pool->m_maxRequest && ptr->m_request >= pool->m_maxRequest);
+    MutexType::MutexLockGuard lock(shard->mutex);
+    if (invalid)
     {
+        --shard->total;
+        WakeOne(*shard, nullptr);
+        lock.unlock();
         delete ptr;
-        --pool->m_total;
         return;
     }
-    MutexType::MutexLockGuard lock(pool->m_mutex);
-    pool->m_conns.push_back(ptr);
+    if (!WakeOne(*shard, ptr))
+        shard->idle.push_front(ptr);
 }
 
 Ref<HttpResult> HttpConnectionPool::doGet(const std::string& url, 
@@ -470,7 +695,7 @@ Ref<HttpResult> HttpConnectionPool::doRequest(HttpMethod method,
     
 Ref<HttpResult> HttpConnectionPool::doRequest(Ref<HttpRequest> req, uint64_t timeout_ms)
 {
-    auto conn = getConnection();
+    auto conn = getConnection(timeout_ms);
     if (!conn)
     {
         return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_GET_CONNECT, nullptr, 
@@ -482,23 +707,33 @@ Ref<HttpResult> HttpConnectionPool::doRequest(Ref<HttpRequest> req, uint64_t tim
         return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_INVALID_CONNECT, nullptr, 
             "pool host: " + m_host + " port = " + std::to_string(m_port));
     }
+    sock->setRecvTimeout(timeout_ms);
     int res = conn->sendRequest(req);
     if (res == 0)
     {
+        conn->close();
         return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_CLOSED_BY_PEER, nullptr, 
             "send closed by peer: " + sock->getRemoteAddress()->toString());
     }
     if (res < 0)
     {
+        conn->close();
         return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_SOCKET_ERROR, nullptr, 
             "send request socket error errno = " + std::to_string(errno) + " errstr = " + strerror(errno));
     }
     auto rsp = conn->recvResponse();
     if (!rsp)
     {
+        conn->close();
         return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT, nullptr, 
             "recv response timeout: " + sock->getRemoteAddress()->toString() + " timeout_ms = " + std::to_string(timeout_ms));   
     }
+    //对端要求关闭的连接不再放回连接池
+    const StringPiece* connection = rsp->findHeader(HttpHeader::CONNECTION);
+    if (connection && connection->size == 5 && strncasecmp(connection->data, "close", 5) == 0)
+    {
+        conn->close();
+    }
     return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
 }                                              
 
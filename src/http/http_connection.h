@@ -3,7 +3,9 @@
 #include "http/http.h"
 #include "uri.h"
 #include "thread.h"
+#include "iomanager.h"
 #include <memory>
+#include <list>
 
 namespace TinyServer
 {
@@ -82,18 +84,24 @@ public:
                                     uint64_t timeout_ms);
 private:
     uint64_t m_createTime = 0;
+    uint64_t m_lastUseTime = 0;     //最近一次归还到连接池的时间
     uint64_t m_request = 0;
 };
 
+//按线程分片的连接池，每个IOManager线程取还连接只锁自己的分片
+//每个分片有LRU空闲链表，连接数上限(maxSize按分片均分)，同时建立连接数的上限
+//达到上限时调用方协程进入等待队列，有连接归还或名额空出时被唤醒
+//maxAliveTime(ms)和maxRequest为0表示不限制
 class HttpConnectionPool
 {
 public:
     typedef MutexLock MutexType;
     HttpConnectionPool(const std::string& host, const std::string& vhost, uint32_t port, uint32_t maxSize,
                         uint32_t maxAliveTime, uint32_t maxRequest);
+    ~HttpConnectionPool();
 
-
-    Ref<HttpConnection> getConnection();
+    //没有可用连接时最多等待timeout_ms，超时或建立连接失败返回nullptr
+    Ref<HttpConnection> getConnection(uint64_t timeout_ms = 5000);
 
     Ref<HttpResult> doGet(const std::string& url, 
                           uint64_t timeout_ms, 
@@ -130,7 +138,36 @@ public:
     Ref<HttpResult> doRequest(Ref<HttpRequest> req, uint64_t timeout_ms);
 
 private:
-    static void ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool);
+    struct Waiter
+    {
+        Ref<Fiber> fiber;
+        IOManager* iom = nullptr;
+        HttpConnection* conn = nullptr;     //归还的连接直接交给等待者
+        bool done = false;
+    };
+
+    struct Shard
+    {
+        MutexType mutex;
+        std::list<HttpConnection*> idle;    //前面是最近归还的，后面最久没用
+        std::list<Ref<Waiter>> waiters;
+        uint32_t total = 0;                 //空闲、使用中和正在建立的连接数
+        uint32_t connecting = 0;
+        uint32_t maxSize = 0;
+    };
+
+    //按当前线程在IOManager中的下标选择分片，非工作线程使用0号分片
+    Shard& getShard();
+    //从其他分片取一个可用的空闲连接，from返回连接所属的分片
+    HttpConnection* stealIdle(Shard& self, Shard*& from, uint64_t now);
+    bool isExpired(HttpConnection* conn, uint64_t now) const;
+    HttpConnection* createConnection(uint64_t timeout_ms);
+    //DNS结果缓存http.connection_pool.dns_ttl毫秒，连接失败时失效
+    Ref<IPAddress> getAddress();
+    Ref<HttpConnection> wrap(HttpConnection* ptr, Shard* shard);
+    //持有shard.mutex时调用，唤醒第一个等待者并交给它conn(可以为nullptr，表示有名额空出)
+    static bool WakeOne(Shard& shard, HttpConnection* conn);
+    static void ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool, Shard* shard);
 
 private:
     std::string m_host;
@@ -140,9 +177,11 @@ private:
     uint32_t m_maxAliveTime;
     uint32_t m_maxRequest;
 
-    MutexType m_mutex;
-    std::list<HttpConnection*> m_conns;
-    std::atomic<uint32_t> m_total = {0};   
+    std::vector<Ref<Shard>> m_shards;
+
+    MutexType m_addrMutex;
+    Ref<IPAddress> m_addr;
+    uint64_t m_addrTime = 0;
 };
 
 
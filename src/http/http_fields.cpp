@@ -0,0 +1,347 @@
+#include "http/http_fields.h"
+#include <strings.h>
+#include <algorithm>
+
+namespace TinyServer
+{
+namespace http
+{
+
+static constexpr char ToLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+}
+
+//常用头部的完美hash: 长度、首尾字符和中间字符的组合，对HTTP_HEADER_MAP中的名字没有冲突
+//HttpHeaderFromName的switch以它为case，新增头部发生冲突时编译报duplicate case value，需要调整系数
+static constexpr uint32_t HeaderHash(const char* name, size_t len)
+{
+    return (len * 2 + ToLower(name[0]) + ToLower(name[len - 1]) * 2 + ToLower(name[len / 2]) * 5) & 63;
+}
+
+static const struct
+{
+    const char* name;
+    size_t len;
+} s_header_names[] = {
+#define XX(id, string) {string, sizeof(string) - 1},
+    HTTP_HEADER_MAP(XX)
+#undef XX
+};
+
+HttpHeader HttpHeaderFromName(const char* name, size_t len)
+{
+    if (len == 0)
+        return HttpHeader::UNKNOWN;
+    HttpHeader h;
+    switch (HeaderHash(name, len))
+    {
+#define XX(id, string) \
+    case HeaderHash(string, sizeof(string) - 1): \
+        h = HttpHeader::id; \
+        break;
+    HTTP_HEADER_MAP(XX)
+#undef XX
+    default:
+        return HttpHeader::UNKNOWN;
+    }
+    auto& known = s_header_names[(int)h];
+    if (known.len != len || strncasecmp(known.name, name, len) != 0)
+        return HttpHeader::UNKNOWN;
+    return h;
+}
+
+const char* HttpHeaderToString(HttpHeader h)
+{
+    uint32_t idx = (uint32_t)h;
+    if (idx >= sizeof(s_header_names) / sizeof(s_header_names[0]))
+        return "<unknow header>";
+    return s_header_names[idx].name;
+}
+
+std::ostream& operator<<(std::ostream& os, const StringPiece& v)
+{
+    return os.write(v.data, v.size);
+}
+
+//第一块的大小，能放下常见请求的全部头部
+static const size_t s_arena_first_block = 1024;
+static const size_t s_arena_max_block = 16 * 1024;
+
+HttpArena::~HttpArena()
+{
+    while (m_head)
+    {
+        Block* next = m_head->next;
+        ::operator delete(m_head);
+        m_head = next;
+    }
+}
+
+char* HttpArena::alloc(size_t size)
+{
+    if (size > m_left)
+    {
+        size_t block_size = m_head ? std::min(m_head->size * 2, s_arena_max_block) : s_arena_first_block;
+        block_size = std::max(block_size, size);
+        Block* block = (Block*)::operator new(sizeof(Block) + block_size);
+        block->next = m_head;
+        block->size = block_size;
+        m_head = block;
+        m_cur = (char*)(block + 1);
+        m_left = block_size;
+    }
+    char* p = m_cur;
+    m_cur += size;
+    m_left -= size;
+    return p;
+}
+
+const char* HttpArena::copy(const char* data, size_t size)
+{
+    if (size == 0)
+        return "";
+    char* p = alloc(size);
+    memcpy(p, data, size);
+    return p;
+}
+
+void HttpArena::clear()
+{
+    if (!m_head)
+        return;
+    while (m_head->next)
+    {
+        Block* next = m_head->next;
+        ::operator delete(m_head);
+        m_head = next;
+    }
+    m_cur = (char*)(m_head + 1);
+    m_left = m_head->size;
+}
+
+uint32_t HttpFieldMap::Hash(const char* key, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = key[i];
+        if (c >= 'A' && c <= 'Z')
+            c |= 0x20;
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+HttpFieldMap::HttpFieldMap()
+    : m_fields(m_inline), m_size(0), m_capacity(s_inline_size)
+{
+
+}
+
+HttpFieldMap::HttpFieldMap(const HttpFieldMap& other)
+    : HttpFieldMap()
+{
+    *this = other;
+}
+
+HttpFieldMap& HttpFieldMap::operator=(const HttpFieldMap& other)
+{
+    if (this == &other)
+        return *this;
+    clear();
+    for (auto& item : other)
+    {
+        set(item.key.data, item.key.size, item.value.data, item.value.size);
+    }
+    return *this;
+}
+
+HttpFieldMap::~HttpFieldMap()
+{
+    if (m_fields != m_inline)
+        delete[] m_fields;
+}
+
+HttpFieldMap::Field* HttpFieldMap::findField(const char* key, size_t len, uint32_t hash) const
+{
+    for (size_t i = 0; i < m_size; ++i)
+    {
+        Field& field = m_fields[i];
+        if (field.hash == hash && field.key.size == len && strncasecmp(field.key.data, key, len) == 0)
+            return &field;
+    }
+    return nullptr;
+}
+
+const StringPiece* HttpFieldMap::find(const char* key, size_t len) const
+{
+    Field* field = findField(key, len, Hash(key, len));
+    return field ? &field->value : nullptr;
+}
+
+HttpFieldMap::Field* HttpFieldMap::append()
+{
+    if (m_size == m_capacity)
+    {
+        Field* fields = new Field[m_capacity * 2];
+        std::copy(m_fields, m_fields + m_size, fields);
+        if (m_fields != m_inline)
+            delete[] m_fields;
+        m_fields = fields;
+        m_capacity *= 2;
+    }
+    return &m_fields[m_size++];
+}
+
+void HttpFieldMap::set(const char* key, size_t klen, const char* val, size_t vlen)
+{
+    uint32_t hash = Hash(key, klen);
+    Field* field = findField(key, klen, hash);
+    if (field)
+    {
+        field->value = StringPiece(m_arena.copy(val, vlen), vlen);
+        return;
+    }
+    field = append();
+    field->key = StringPiece(m_arena.copy(key, klen), klen);
+    field->value = StringPiece(m_arena.copy(val, vlen), vlen);
+    field->hash = hash;
+}
+
+bool HttpFieldMap::add(const char* key, size_t klen, const char* val, size_t vlen, bool copy)
+{
+    uint32_t hash = Hash(key, klen);
+    if (findField(key, klen, hash))
+        return false;
+    Field* field = append();
+    field->key = StringPiece(copy ? m_arena.copy(key, klen) : key, klen);
+    field->value = StringPiece(copy ? m_arena.copy(val, vlen) : val, vlen);
+    field->hash = hash;
+    return true;
+}
+
+bool HttpFieldMap::erase(const std::string& key)
+{
+    Field* field = findField(key.data(), key.size(), Hash(key.data(), key.size()));
+    if (!field)
+        return false;
+    std::copy(field + 1, m_fields + m_size, field);
+    --m_size;
+    return true;
+}
+
+void HttpFieldMap::clear()
+{
+    m_size = 0;
+    m_arena.clear();
+}
+
+HttpHeaderMap::const_iterator::const_iterator(const HttpHeaderMap* map, size_t index)
+    : m_map(map), m_index(index)
+{
+    load();
+}
+
+HttpHeaderMap::const_iterator& HttpHeaderMap::const_iterator::operator++()
+{
+    ++m_index;
+    load();
+    return *this;
+}
+
+HttpHeader HttpHeaderMap::const_iterator::header() const
+{
+    return m_index < s_known_count ? (HttpHeader)m_index : HttpHeader::UNKNOWN;
+}
+
+void HttpHeaderMap::const_iterator::load()
+{
+    while (m_index < s_known_count && !((m_map->m_mask >> m_index) & 1))
+    {
+        ++m_index;
+    }
+    if (m_index < s_known_count)
+    {
+        m_field.key = StringPiece(s_header_names[m_index].name, s_header_names[m_index].len);
+        m_field.value = m_map->m_known[m_index];
+        m_field.hash = 0;
+    }
+    else if (m_index - s_known_count < m_map->m_others.size())
+    {
+        m_field = *(m_map->m_others.begin() + (m_index - s_known_count));
+    }
+}
+
+HttpHeaderMap::HttpHeaderMap(const HttpHeaderMap& other)
+{
+    *this = other;
+}
+
+HttpHeaderMap& HttpHeaderMap::operator=(const HttpHeaderMap& other)
+{
+    if (this == &other)
+        return *this;
+    //常用头部的值在other的arena中，要复制到自己的arena
+    m_others = other.m_others;
+    m_mask = 0;
+    for (size_t i = 0; i < s_known_count; ++i)
+    {
+        if ((other.m_mask >> i) & 1)
+        {
+            set((HttpHeader)i, other.m_known[i].data, other.m_known[i].size);
+        }
+    }
+    return *this;
+}
+
+const StringPiece* HttpHeaderMap::find(const char* key, size_t len) const
+{
+    HttpHeader h = HttpHeaderFromName(key, len);
+    if (h != HttpHeader::UNKNOWN)
+        return find(h);
+    return m_others.find(key, len);
+}
+
+void HttpHeaderMap::set(HttpHeader h, const char* val, size_t vlen)
+{
+    m_known[(int)h] = StringPiece(m_others.getArena().copy(val, vlen), vlen);
+    m_mask |= 1ull << (int)h;
+}
+
+void HttpHeaderMap::set(const char* key, size_t klen, const char* val, size_t vlen)
+{
+    HttpHeader h = HttpHeaderFromName(key, klen);
+    if (h != HttpHeader::UNKNOWN)
+    {
+        set(h, val, vlen);
+        return;
+    }
+    m_others.set(key, klen, val, vlen);
+}
+
+bool HttpHeaderMap::erase(HttpHeader h)
+{
+    if (!find(h))
+        return false;
+    m_mask &= ~(1ull << (int)h);
+    return true;
+}
+
+bool HttpHeaderMap::erase(const std::string& key)
+{
+    HttpHeader h = HttpHeaderFromName(key.data(), key.size());
+    if (h != HttpHeader::UNKNOWN)
+        return erase(h);
+    return m_others.erase(key);
+}
+
+void HttpHeaderMap::clear()
+{
+    m_mask = 0;
+    m_others.clear();
+}
+
+}
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <ostream>
+#include "noncoptable.h"
+
+namespace TinyServer
+{
+namespace http
+{
+/* Well-known headers */
+#define HTTP_HEADER_MAP(XX)                             \
+  XX(HOST,                 "Host")                      \
+  XX(CONNECTION,           "Connection")                \
+  XX(CONTENT_LENGTH,       "Content-Length")            \
+  XX(CONTENT_TYPE,         "Content-Type")              \
+  XX(TRANSFER_ENCODING,    "Transfer-Encoding")         \
+  XX(KEEP_ALIVE,           "Keep-Alive")                \
+  XX(COOKIE,               "Cookie")                    \
+  XX(SET_COOKIE,           "Set-Cookie")                \
+  XX(ACCEPT,               "Accept")                    \
+  XX(ACCEPT_ENCODING,      "Accept-Encoding")           \
+  XX(ACCEPT_LANGUAGE,      "Accept-Language")           \
+  XX(USER_AGENT,           "User-Agent")                \
+  XX(REFERER,              "Referer")                   \
+  XX(ORIGIN,               "Origin")                    \
+  XX(AUTHORIZATION,        "Authorization")             \
+  XX(CACHE_CONTROL,        "Cache-Control")             \
+  XX(IF_NONE_MATCH,        "If-None-Match")             \
+  XX(IF_MODIFIED_SINCE,    "If-Modified-Since")         \
+  XX(IF_RANGE,             "If-Range")                  \
+  XX(RANGE,                "Range")                     \
+  XX(ETAG,                 "ETag")                      \
+  XX(LAST_MODIFIED,        "Last-Modified")             \
+  XX(UPGRADE,              "Upgrade")                   \
+  XX(DATE,                 "Date")                      \
+  XX(SERVER,               "Server")                    \
+  XX(LOCATION,             "Location")                  \
+  XX(CONTENT_ENCODING,     "Content-Encoding")          \
+  XX(CONTENT_RANGE,        "Content-Range")             \
+  XX(EXPECT,               "Expect")                    \
+
+enum class HttpHeader
+{
+#define XX(name, string) name,
+    HTTP_HEADER_MAP(XX)
+#undef XX
+    UNKNOWN
+};
+
+//不在HTTP_HEADER_MAP中返回HttpHeader::UNKNOWN，大小写不敏感
+HttpHeader HttpHeaderFromName(const char* name, size_t len);
+const char* HttpHeaderToString(HttpHeader h);
+
+//指向一段不以\0结尾的字符串，不持有内存(c++11没有string_view)
+struct StringPiece
+{
+    const char* data;
+    size_t size;
+
+    StringPiece() : data(""), size(0) {}
+    StringPiece(const char* d, size_t s) : data(d), size(s) {}
+    StringPiece(const std::string& s) : data(s.data()), size(s.size()) {}
+
+    bool empty() const { return size == 0; }
+    std::string toString() const { return std::string(data, size); }
+};
+
+std::ostream& operator<<(std::ostream& os, const StringPiece& v);
+
+//按块分配的字符串内存，只在clear或析构时整体释放
+//第一块在第一次分配时申请，一个请求的所有头部通常只需要一次malloc
+class HttpArena : Noncopyable
+{
+public:
+    HttpArena() {}
+    ~HttpArena();
+
+    char* alloc(size_t size);
+    const char* copy(const char* data, size_t size);
+    //保留第一块，释放其余的块
+    void clear();
+
+private:
+    struct Block
+    {
+        Block* next;
+        size_t size;
+    };
+    Block* m_head = nullptr;        //最新的块在前面
+    char* m_cur = nullptr;
+    size_t m_left = 0;
+};
+
+//扁平的大小写不敏感的key-value表，用来存放头部、参数和cookie
+//字符串都复制到自己的arena中，字段放在小数组里(不超过s_inline_size个时不申请内存)
+//每个字段保存key的小写hash，查找时先比较hash再比较字符串
+//保持插入顺序，同一个key只保留最后一次设置的值
+class HttpFieldMap
+{
+public:
+    struct Field
+    {
+        StringPiece key;
+        StringPiece value;
+        uint32_t hash;
+    };
+    typedef const Field* const_iterator;
+
+    HttpFieldMap();
+    HttpFieldMap(const HttpFieldMap& other);
+    HttpFieldMap& operator=(const HttpFieldMap& other);
+    ~HttpFieldMap();
+
+    //没有找到返回nullptr，返回的指针在下一次修改前有效
+    const StringPiece* find(const char* key, size_t len) const;
+    const StringPiece* find(const std::string& key) const { return find(key.data(), key.size()); }
+    void set(const char* key, size_t klen, const char* val, size_t vlen);
+    void set(const std::string& key, const std::string& val) { set(key.data(), key.size(), val.data(), val.size()); }
+    //key不存在时才加入，返回是否加入。copy为false时key和val必须已经在getArena()中分配
+    bool add(const char* key, size_t klen, const char* val, size_t vlen, bool copy = true);
+    bool erase(const std::string& key);
+    void clear();
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const_iterator begin() const { return m_fields; }
+    const_iterator end() const { return m_fields + m_size; }
+
+    //key转为小写后的FNV-1a
+    static uint32_t Hash(const char* key, size_t len);
+    //同一个对象内的其他数据(如HttpHeaderMap的常用头部)共用这块内存
+    HttpArena& getArena() { return m_arena; }
+
+private:
+    Field* findField(const char* key, size_t len, uint32_t hash) const;
+    Field* append();
+
+private:
+    static const size_t s_inline_size = 16;
+    HttpArena m_arena;
+    Field* m_fields;
+    size_t m_size;
+    size_t m_capacity;
+    Field m_inline[s_inline_size];
+};
+
+//头部表: HTTP_HEADER_MAP中的常用头部放在按枚举下标的固定位置，O(1)访问
+//其余头部放在HttpFieldMap中。按名字访问时先用完美hash识别常用头部
+//遍历时先按枚举顺序给出常用头部(名字为规范写法)，再按插入顺序给出其余头部
+class HttpHeaderMap
+{
+public:
+    class const_iterator
+    {
+    public:
+        const_iterator(const HttpHeaderMap* map, size_t index);
+        const HttpFieldMap::Field& operator*() const { return m_field; }
+        const HttpFieldMap::Field* operator->() const { return &m_field; }
+        const_iterator& operator++();
+        bool operator==(const const_iterator& o) const { return m_index == o.m_index; }
+        bool operator!=(const const_iterator& o) const { return m_index != o.m_index; }
+        //常用头部返回对应的枚举，其余返回HttpHeader::UNKNOWN
+        HttpHeader header() const;
+
+    private:
+        //跳过不存在的常用头部，取出当前字段
+        void load();
+
+    private:
+        const HttpHeaderMap* m_map;
+        size_t m_index;
+        HttpFieldMap::Field m_field;
+    };
+
+    HttpHeaderMap() {}
+    HttpHeaderMap(const HttpHeaderMap& other);
+    HttpHeaderMap& operator=(const HttpHeaderMap& other);
+
+    const StringPiece* find(HttpHeader h) const
+    {
+        return (m_mask >> (int)h) & 1 ? &m_known[(int)h] : nullptr;
+    }
+    const StringPiece* find(const char* key, size_t len) const;
+    const StringPiece* find(const std::string& key) const { return find(key.data(), key.size()); }
+
+    void set(HttpHeader h, const char* val, size_t vlen);
+    void set(const char* key, size_t klen, const char* val, size_t vlen);
+    void set(const std::string& key, const std::string& val) { set(key.data(), key.size(), val.data(), val.size()); }
+
+    bool erase(HttpHeader h);
+    bool erase(const std::string& key);
+    void clear();
+
+    size_t size() const { return __builtin_popcountll(m_mask) + m_others.size(); }
+    bool empty() const { return size() == 0; }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, s_known_count + m_others.size()); }
+
+    //不在HTTP_HEADER_MAP中的头部
+    const HttpFieldMap& getOthers() const { return m_others; }
+
+private:
+    static const size_t s_known_count = (size_t)HttpHeader::UNKNOWN;
+    static_assert(s_known_count <= 64, "m_mask has one bit per well-known header");
+    HttpFieldMap m_others;
+    uint64_t m_mask = 0;
+    StringPiece m_known[s_known_count];
+};
+
+}
+}
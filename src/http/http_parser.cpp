@@ -1,4 +1,5 @@
 #include "http_parser.h"
+#include "http_scan.h"
 #include "config.h"
 
 namespace TinyServer
@@ -19,10 +20,21 @@ static Ref<ConfigVar<uint64_t>> http_request_max_body_size =
 static Ref<ConfigVar<uint64_t>> http_response_max_body_size = 
     Config::Lookup("http.response.max_body_size", (uint64_t)64 * 1024 * 1024, "http response max body size"); 
 
+static Ref<ConfigVar<uint64_t>> http_request_max_header_size = 
+    Config::Lookup("http.request.max_header_size", (uint64_t)64 * 1024, "http request max header size"); 
+
+static Ref<ConfigVar<uint64_t>> http_request_stream_body_size = 
+    Config::Lookup("http.request.stream_body_size", (uint64_t)64 * 1024, "http request body larger than this is streamed"); 
+
+static Ref<ConfigVar<bool>> http_request_fast_scan = 
+    Config::Lookup("http.request.fast_scan", true, "scan common http request header lines without ragel"); 
+
 static uint64_t s_http_request_buffer_size = 0;
 static uint64_t s_http_response_buffer_size = 0;
 static uint64_t s_http_request_max_body_size = 0;
 static uint64_t s_http_response_max_body_size = 0;
+static uint64_t s_http_request_max_header_size = 0;
+static uint64_t s_http_request_stream_body_size = 0;
 
 namespace
 {
@@ -34,6 +46,8 @@ struct RequestSizeIniter
         s_http_response_buffer_size = http_response_buffer_size->getValue();
         s_http_request_max_body_size = http_request_max_body_size->getValue();
         s_http_response_max_body_size = http_response_buffer_size->getValue();
+        s_http_request_max_header_size = http_request_max_header_size->getValue();
+        s_http_request_stream_body_size = http_request_stream_body_size->getValue();
 
         http_request_buffer_size->setCallBack([](const uint64_t& old_value, const uint64_t& new_value){
             s_http_request_buffer_size = new_value;
@@ -50,6 +64,14 @@ struct RequestSizeIniter
         http_response_max_body_size->setCallBack([](const uint64_t& old_value, const uint64_t& new_value){
             s_http_response_max_body_size = new_value;
         });
+
+        http_request_max_header_size->setCallBack([](const uint64_t& old_value, const uint64_t& new_value){
+            s_http_request_max_header_size = new_value;
+        });
+
+        http_request_stream_body_size->setCallBack([](const uint64_t& old_value, const uint64_t& new_value){
+            s_http_request_stream_body_size = new_value;
+        });
     }
 };
 
@@ -66,6 +88,16 @@ uint64_t HttpRequestParser::GetHttpRequestMaxBodyLength()
     return s_http_request_max_body_size;
 }
 
+uint64_t HttpRequestParser::GetHttpRequestMaxHeaderSize()
+{
+    return s_http_request_max_header_size;
+}
+
+uint64_t HttpRequestParser::GetHttpRequestStreamBodySize()
+{
+    return s_http_request_stream_body_size;
+}
+
 uint64_t HttpResponseParser::GetHttpResponseBufferSize()
 {
     return s_http_response_buffer_size;
@@ -145,11 +177,11 @@ void on_request_http_field(void *data, const char *field, size_t flen, const cha
         //parser->setError(1002);
         return;
     }
-    parser->getData()->setHeader(std::string(field, flen), std::string(value, vlen));
+    parser->getData()->setHeader(field, flen, value, vlen);
 }
 
 HttpRequestParser::HttpRequestParser()
-    : m_error(0)
+    : m_started(false), m_error(0)
 {
     m_data.reset(new HttpRequest);
     http_parser_init(&m_parser);
@@ -169,11 +201,53 @@ HttpRequestParser::HttpRequestParser()
 //>0: 已处理的字节数， 且data有效数据为len - v
 size_t HttpRequestParser::execute(char *data, size_t len)
 {
-    size_t offset = http_parser_execute(&m_parser, data, len, 0);
+    size_t offset = 0;
+    if (!m_started && http_request_fast_scan->getValue())
+        offset = fastExecute(data, len);
+    else
+        offset = http_parser_execute(&m_parser, data, len, 0);
+    m_started = true;
     memmove(data, data + offset, (len - offset));
     return offset;
 }
 
+//只接受 name ":" [SP|HT]* value "\r\n" 形式的头部行，value非空、首尾不是空白、下一行不是折行
+//遇到其他形式(空值、折行、单独的\n、非法字符等)从该行开始交回ragel，结果与全部由ragel解析一致
+size_t HttpRequestParser::fastExecute(const char* data, size_t len)
+{
+    const char* end = data + len;
+    const char* lf = (const char*)memchr(data, '\n', len);
+    if (!lf || lf == data || lf[-1] != '\r')
+        return http_parser_execute(&m_parser, data, len, 0);
+    const char* p = lf + 1;
+    http_parser_execute(&m_parser, data, p - data, 0);
+    if (http_parser_has_error(&m_parser))
+        return m_parser.nread;
+
+    while (p < end)
+    {
+        size_t nlen = ScanToken(p, end - p);
+        const char* q = p + nlen;
+        if (nlen == 0 || q == end || *q != ':')
+            break;
+        ++q;
+        while (q < end && (*q == ' ' || *q == '\t'))
+        {
+            ++q;
+        }
+        const char* value = q;
+        size_t vlen = ScanFieldValue(q, end - q);
+        q += vlen;
+        if (vlen == 0 || end - q < 3 || q[0] != '\r' || q[1] != '\n'
+            || q[2] == ' ' || q[2] == '\t'
+            || value[vlen - 1] == ' ' || value[vlen - 1] == '\t')
+            break;
+        on_request_http_field(this, p, nlen, value, vlen);
+        p = q + 2;
+    }
+    return (p - data) + http_parser_execute(&m_parser, p, end - p, 0);
+}
+
 int HttpRequestParser::isFinished()
 {
     return http_parser_finish(&m_parser);
@@ -186,7 +260,7 @@ int HttpRequestParser::hasError()
 
 uint64_t HttpRequestParser::getContentLength()
 {
-    return m_data->getHeaderAs<uint64_t>("content-length", 0);
+    return m_data->getHeaderAs<uint64_t>(HttpHeader::CONTENT_LENGTH, 0);
 }
 
 //Response
@@ -244,7 +318,7 @@ void on_response_http_field(void *data, const char *field, size_t flen, const ch
         //parser->setError(1002);
         return;
     }
-    parser->getData()->setHeader(std::string(field, flen), std::string(value, vlen));
+    parser->getData()->setHeader(field, flen, value, vlen);
 }
 
 HttpResponseParser::HttpResponseParser()
@@ -285,7 +359,7 @@ int HttpResponseParser::hasError()
 
 uint64_t HttpResponseParser::getContentLength()
 {
-    return m_data->getHeaderAs<uint64_t>("content-length", 0);
+    return m_data->getHeaderAs<uint64_t>(HttpHeader::CONTENT_LENGTH, 0);
 }
 
 }
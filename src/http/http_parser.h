@@ -23,12 +23,23 @@ public:
     const http_parser& getParser() const { return m_parser; }
 
 public:
+    //每次从socket读取的大小，也是连接输入缓冲的初始大小
     static uint64_t GetHttpRequestBufferSize();
     static uint64_t GetHttpRequestMaxBodyLength();
+    //请求行加所有头部的上限，输入缓冲最多增长到这么大
+    static uint64_t GetHttpRequestMaxHeaderSize();
+    //超过这个大小的body不预先读入，由servlet通过HttpRequest::getBodyStream读取
+    static uint64_t GetHttpRequestStreamBodySize();
+
+private:
+    //第一次execute时使用: 请求行交给ragel，常见形式的头部行直接扫描切分
+    size_t fastExecute(const char* data, size_t len);
 
 private:
     http_parser m_parser;
     Ref<HttpRequest> m_data;
+    //是否已经调用过execute，只有从头开始的数据才能走fastExecute
+    bool m_started;
     //1000:invalid request method
     //1001:invalid http version
     //1002:invalid http field
@@ -0,0 +1,265 @@
+#include "http/http_scan.h"
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define HTTP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace TinyServer
+{
+namespace http
+{
+
+//与http11_parser.rl一致: token = ascii -- (CTL | separator)
+static bool IsTokenChar(unsigned char c)
+{
+    if (c <= 0x20 || c >= 0x7f)
+        return false;
+    switch (c)
+    {
+    case '(': case ')': case '<': case '>': case '@':
+    case ',': case ';': case ':': case '\\': case '"':
+    case '/': case '[': case ']': case '?': case '=':
+    case '{': case '}':
+        return false;
+    default:
+        return true;
+    }
+}
+
+//content = (any -- CTL) | lws，\r\n由调用方处理
+static bool IsValueChar(unsigned char c)
+{
+    return (c >= 0x20 && c != 0x7f) || c == '\t';
+}
+
+static bool s_token[256];
+static bool s_value[256];
+
+static size_t ScanTokenScalar(const char* data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && s_token[(unsigned char)data[i]])
+    {
+        ++i;
+    }
+    return i;
+}
+
+static size_t ScanFieldValueScalar(const char* data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && s_value[(unsigned char)data[i]])
+    {
+        ++i;
+    }
+    return i;
+}
+
+#ifdef HTTP_SCAN_X86
+//pcmpestri的范围最多8组，这里多包含了'!'和'|'两个token字符，命中后再查表确认
+alignas(16) static const char s_token_ranges[16] = {
+    '\x00', '\x22', '\x28', '\x29', '\x2c', '\x2c', '\x2f', '\x2f',
+    '\x3a', '\x40', '\x5b', '\x5d', '\x7b', '\x7d', '\x7f', '\xff'
+};
+alignas(16) static const char s_value_ranges[16] = {
+    '\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'
+};
+
+__attribute__((target("sse4.2")))
+static size_t ScanTokenSse42(const char* data, size_t len)
+{
+    const __m128i ranges = _mm_load_si128((const __m128i*)s_token_ranges);
+    size_t i = 0;
+    while (i + 16 <= len)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i));
+        int idx = _mm_cmpestri(ranges, 16, b, 16,
+            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx == 16)
+        {
+            i += 16;
+            continue;
+        }
+        i += idx;
+        if (!s_token[(unsigned char)data[i]])
+            return i;
+        ++i;
+    }
+    return i + ScanTokenScalar(data + i, len - i);
+}
+
+__attribute__((target("sse4.2")))
+static size_t ScanFieldValueSse42(const char* data, size_t len)
+{
+    const __m128i ranges = _mm_load_si128((const __m128i*)s_value_ranges);
+    size_t i = 0;
+    while (i + 16 <= len)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i));
+        int idx = _mm_cmpestri(ranges, 6, b, 16,
+            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16)
+            return i + idx;
+        i += 16;
+    }
+    return i + ScanFieldValueScalar(data + i, len - i);
+}
+
+//token的nibble查表: s_token_lo[低4位]的第h位表示(h << 4 | 低4位)是token，s_token_hi[h] = 1 << h
+//0x80以上的高4位查到0，两个表按位与为0即不是token。vpshufb按128位分别查表，所以各存两份
+alignas(32) static uint8_t s_token_lo[32];
+alignas(32) static uint8_t s_token_hi[32];
+
+__attribute__((target("avx2")))
+static size_t ScanTokenAvx2(const char* data, size_t len)
+{
+    const __m256i lo_lut = _mm256_load_si256((const __m256i*)s_token_lo);
+    const __m256i hi_lut = _mm256_load_si256((const __m256i*)s_token_hi);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    while (i + 32 <= len)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i lo = _mm256_shuffle_epi8(lo_lut, _mm256_and_si256(b, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hi_lut, _mm256_and_si256(_mm256_srli_epi16(b, 4), nibble));
+        __m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+        uint32_t mask = _mm256_movemask_epi8(bad);
+        if (mask)
+            return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    //切换到非VEX编码的SSE指令前清掉ymm高位，避免状态切换的开销
+    _mm256_zeroupper();
+    return i + ScanTokenSse42(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t ScanFieldValueAvx2(const char* data, size_t len)
+{
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+    while (i + 32 <= len)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i));
+        //max(b, 0x1f) == 0x1f 即 b <= 0x1f
+        __m256i is_ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(b, ctl), ctl);
+        __m256i bad = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(b, tab), is_ctl),
+            _mm256_cmpeq_epi8(b, del));
+        uint32_t mask = _mm256_movemask_epi8(bad);
+        if (mask)
+            return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    //切换到非VEX编码的SSE指令前清掉ymm高位，避免状态切换的开销
+    _mm256_zeroupper();
+    return i + ScanFieldValueSse42(data + i, len - i);
+}
+#endif
+
+typedef size_t (*ScanFun)(const char* data, size_t len);
+
+static ScanIsa s_isa = ScanIsa::SCALAR;
+static ScanFun s_scan_token = ScanTokenScalar;
+static ScanFun s_scan_value = ScanFieldValueScalar;
+
+static ScanIsa SupportedIsa()
+{
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+        return ScanIsa::AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return ScanIsa::SSE42;
+#endif
+    return ScanIsa::SCALAR;
+}
+
+ScanIsa GetScanIsa()
+{
+    return s_isa;
+}
+
+ScanIsa SetScanIsa(ScanIsa isa)
+{
+    if ((int)isa > (int)SupportedIsa())
+        isa = SupportedIsa();
+    s_isa = isa;
+    switch (isa)
+    {
+#ifdef HTTP_SCAN_X86
+    case ScanIsa::AVX2:
+        s_scan_token = ScanTokenAvx2;
+        s_scan_value = ScanFieldValueAvx2;
+        break;
+    case ScanIsa::SSE42:
+        s_scan_token = ScanTokenSse42;
+        s_scan_value = ScanFieldValueSse42;
+        break;
+#endif
+    default:
+        s_scan_token = ScanTokenScalar;
+        s_scan_value = ScanFieldValueScalar;
+        break;
+    }
+    return isa;
+}
+
+const char* ScanIsaToString(ScanIsa isa)
+{
+    switch (isa)
+    {
+    case ScanIsa::AVX2:
+        return "avx2";
+    case ScanIsa::SSE42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
+
+size_t ScanToken(const char* data, size_t len)
+{
+    return s_scan_token(data, len);
+}
+
+size_t ScanFieldValue(const char* data, size_t len)
+{
+    return s_scan_value(data, len);
+}
+
+namespace
+{
+struct ScanIniter
+{
+    ScanIniter()
+    {
+        for (int c = 0; c < 256; ++c)
+        {
+            s_token[c] = IsTokenChar(c);
+            s_value[c] = IsValueChar(c);
+#ifdef HTTP_SCAN_X86
+            if (s_token[c])
+            {
+                s_token_lo[c & 0x0f] |= 1 << (c >> 4);
+                s_token_lo[16 + (c & 0x0f)] |= 1 << (c >> 4);
+            }
+#endif
+        }
+#ifdef HTTP_SCAN_X86
+        for (int h = 0; h < 8; ++h)
+        {
+            s_token_hi[h] = s_token_hi[16 + h] = 1 << h;
+        }
+#endif
+        SetScanIsa(ScanIsa::AVX2);
+    }
+};
+
+static ScanIniter __scan_initer;
+}
+
+}
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+
+namespace TinyServer
+{
+namespace http
+{
+//头部扫描使用的指令集，启动时按CPU支持情况选择最高的一档
+enum class ScanIsa
+{
+    SCALAR = 0,
+    SSE42 = 1,
+    AVX2 = 2
+};
+
+ScanIsa GetScanIsa();
+//指定指令集(用于对比测试)，CPU不支持时降级，返回实际使用的指令集
+ScanIsa SetScanIsa(ScanIsa isa);
+const char* ScanIsaToString(ScanIsa isa);
+
+//返回data开头连续的token字符(头部名字允许的字符)个数
+size_t ScanToken(const char* data, size_t len);
+//返回data开头连续的头部值字符(除\t外的控制字符以外的所有字节)个数，在\r、\n处停止
+size_t ScanFieldValue(const char* data, size_t len);
+
+}
+}
@@ -28,13 +28,33 @@ void HttpServer::handleClient(Ref<Socket> client)
         Ref<HttpResponse> rsp(new HttpResponse(req->getVersion(), req->isClose() || !m_isKeepalive));
         rsp->setHeader("Server", getName());
         m_dispatch->handle(req, rsp, session);
-        session->sendResponse(rsp);
+        bool close = !m_isKeepalive || req->isClose() || rsp->isColse();
+        if (rsp->getBodyStream())
+        {
+            //流式响应的头部和body已经发出，补上结束chunk
+            rsp->getBodyStream()->close();
+            if (!session->isConnected())
+            {
+                break;
+            }
+        }
+        //流水线中后面的请求已经读到时先不发，处理完这一批再一起writev
+        else if (!session->queueResponse(rsp) || close || !session->hasBufferedRequest())
+        {
+            if (session->flush() <= 0)
+            {
+                TINY_LOG_WARN(logger) << "send http response fail, errno = " << errno
+                    << " errstr = " << strerror(errno) << " client: " << *client;
+                break;
+            }
+        }
         
-        if(!m_isKeepalive || req->isClose()) 
+        if(close) 
         {
             break;
         }
     } while (true);
+    session->flush();
     
 }
 
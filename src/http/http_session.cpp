@@ -1,90 +1,517 @@
 #include "http_session.h"
 #include "http/http_parser.h"
+#include "log.h"
+#include "hook.h"
+#include <string.h>
+#include <sys/socket.h>
+#include <algorithm>
 
 namespace TinyServer
 {
 namespace http
 {
 
+static Ref<Logger> logger = TINY_LOG_NAME("system");
+
 HttpSession::HttpSession(Ref<Socket> sock, bool owner)
     : SocketStream(sock, owner)
 {
 
 }
 
-Ref<HttpRequest> HttpSession::recvRequest()
+int HttpSession::fill(size_t max_size)
 {
-    Ref<HttpRequestParser> parser(new HttpRequestParser);
-    uint64_t buffer_size = HttpRequestParser::GetHttpRequestBufferSize();
-    std::shared_ptr<char> buffers(new char[buffer_size], [](char* ptr){
-        delete[] ptr;
-    });
-    char* data = buffers.get();
-    size_t offset = 0;
-    do
-    {
-        int len = read(data + offset, buffer_size - offset);
+    if (m_end == m_buf.size())
+    {
+        if (m_begin > 0)
+        {
+            memmove(&m_buf[0], &m_buf[m_begin], m_end - m_begin);
+            m_end -= m_begin;
+            m_begin = 0;
+        }
+        if (m_end == m_buf.size())
+        {
+            if (m_buf.size() >= max_size)
+                return -1;
+            m_buf.resize(std::min(std::max(m_buf.size() * 2, (size_t)1024), max_size));
+        }
+    }
+    int len = read(&m_buf[m_end], m_buf.size() - m_end);
+    if (len > 0)
+        m_end += len;
+    return len;
+}
+
+bool HttpSession::skipBody()
+{
+    while (m_bodyLeft > 0)
+    {
+        size_t avail = m_end - m_begin;
+        if (avail > 0)
+        {
+            size_t n = std::min((uint64_t)avail, m_bodyLeft);
+            m_begin += n;
+            m_bodyLeft -= n;
+            continue;
+        }
+        m_begin = m_end = 0;
+        if (m_buf.empty())
+            m_buf.resize(HttpRequestParser::GetHttpRequestBufferSize());
+        int len = read(&m_buf[0], std::min((uint64_t)m_buf.size(), m_bodyLeft));
         if (len <= 0)
+            return false;
+        m_bodyLeft -= len;
+    }
+    return true;
+}
+
+//拒绝请求后关闭前最多再读走的数据和每次读的超时
+static const size_t s_lingering_size = 1024 * 1024;
+static const uint64_t s_lingering_timeout = 1000;
+
+void HttpSession::reject(HttpStatus status, uint8_t version)
+{
+    Ref<HttpResponse> rsp(new HttpResponse(version, true));
+    rsp->setStatus(status);
+    if (sendResponse(rsp) > 0)
+    {
+        //还有未读的输入时直接close会发RST，客户端可能收不到响应，先关闭写端并读走剩余的数据
+        Ref<Socket> sock = getSocket();
+        ::shutdown(sock->getSocket(), SHUT_WR);
+        sock->setRecvTimeout(s_lingering_timeout);
+        char buf[4096];
+        size_t total = 0;
+        while (total < s_lingering_size)
         {
-            close();
-            return nullptr;
+            int len = sock->recv(buf, sizeof(buf));
+            if (len <= 0)
+                break;
+            total += len;
         }
-        len += offset;
-        size_t nparser = parser->execute(data, len);
-        if (parser->hasError())
-            return nullptr;
-        offset = len - nparser;
-        if (offset == buffer_size)
+    }
+    close();
+}
+
+Ref<HttpRequest> HttpSession::recvRequest()
+{
+    ++m_requestCount;
+    if (!skipBody())
+    {
+        close();
+        return nullptr;
+    }
+    uint64_t buffer_size = std::max((uint64_t)1024, HttpRequestParser::GetHttpRequestBufferSize());
+    uint64_t max_header = std::max(buffer_size, HttpRequestParser::GetHttpRequestMaxHeaderSize());
+    if (m_begin == m_end)
+    {
+        m_begin = m_end = 0;
+        //上一个请求头部很大时扩容过，空闲时还原
+        if (m_buf.size() != buffer_size)
+        {
+            std::vector<char>(buffer_size).swap(m_buf);
+        }
+    }
+
+    //找到完整的头部(\r\n\r\n)后再交给解析器，解析器不必处理跨读取的字段
+    size_t header_len = 0;
+    size_t scanned = 0;
+    while (true)
+    {
+        size_t avail = m_end - m_begin;
+        size_t from = scanned > 3 ? scanned - 3 : 0;
+        if (avail >= 4)
+        {
+            const char* begin = &m_buf[m_begin];
+            const char* end = (const char*)memmem(begin + from, avail - from, "\r\n\r\n", 4);
+            if (end)
+            {
+                header_len = (end - begin) + 4;
+                break;
+            }
+        }
+        scanned = avail;
+        if (avail >= max_header)
+        {
+            TINY_LOG_WARN(logger) << "http request header too large, limit = " << max_header;
+            reject(HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE, 0x11);
             return nullptr;
-        if (parser->isFinished())
+        }
+        int len = fill(max_header);
+        if (len <= 0)
         {
-            break;
+            close();
+            return nullptr;
         }
-    } while (true);
-    
-    int length = parser->getContentLength();
-    if (length > 0)
+    }
+
+    Ref<HttpRequestParser> parser(new HttpRequestParser);
+    size_t nparser = parser->execute(&m_buf[m_begin], header_len);
+    if (parser->hasError() || !parser->isFinished())
+        return nullptr;
+    m_begin += nparser;
+    Ref<HttpRequest> req = parser->getData();
+    m_headRequest = req->getMethod() == HttpMethod::HEAD;
+
+    //请求只按Content-Length分帧，不支持分块的请求body
+    //带Transfer-Encoding的请求如果继续处理，body会被当成流水线中的下一个请求(请求走私)
+    if (req->findHeader(HttpHeader::TRANSFER_ENCODING))
+    {
+        TINY_LOG_WARN(logger) << "http request with transfer-encoding is not supported";
+        reject(req->findHeader(HttpHeader::CONTENT_LENGTH) ? HttpStatus::BAD_REQUEST 
+            : HttpStatus::NOT_IMPLEMENTED, req->getVersion());
+        return nullptr;
+    }
+
+    uint64_t length = parser->getContentLength();
+    if (length > HttpRequestParser::GetHttpRequestMaxBodyLength())
+    {
+        TINY_LOG_WARN(logger) << "http request body too large, length = " << length;
+        reject(HttpStatus::PAYLOAD_TOO_LARGE, req->getVersion());
+        return nullptr;
+    }
+    if (length > HttpRequestParser::GetHttpRequestStreamBodySize())
+    {
+        m_bodyLeft = length;
+        req->setBodyStream(Ref<HttpBodyStream>(new HttpBodyStream(shared_from_this())));
+    }
+    else if (length > 0)
     {
         std::string body;
         body.resize(length);
-        int len = 0;
-        if (length >= (int)offset)
+        size_t n = std::min((uint64_t)(m_end - m_begin), length);
+        memcpy(&body[0], &m_buf[m_begin], n);
+        m_begin += n;
+        if (n < length)
+        {
+            if (readFixSize(&body[n], length - n) <= 0)
+            {
+                close();
+                return nullptr;
+            }
+        }
+        req->setBody(body);
+    }
+    const StringPiece* keep_alive = req->findHeader(HttpHeader::CONNECTION);
+    if (keep_alive && keep_alive->size == 10 && strncasecmp("keep-alive", keep_alive->data, 10) == 0)
+    {
+        req->setClose(false);
+    }
+    return req;
+}
+
+int HttpSession::readBody(void* buffer, size_t length)
+{
+    if (m_bodyLeft == 0)
+        return 0;
+    length = std::min((uint64_t)length, m_bodyLeft);
+    size_t avail = m_end - m_begin;
+    int len = 0;
+    if (avail > 0)
+    {
+        len = std::min(avail, length);
+        memcpy(buffer, &m_buf[m_begin], len);
+        m_begin += len;
+    }
+    else
+    {
+        len = read(buffer, length);
+        if (len <= 0)
+            return len;
+    }
+    m_bodyLeft -= len;
+    return len;
+}
+
+//排队的响应超过这些就要先发出去
+static const size_t s_max_queued_responses = 64;
+static const size_t s_max_queued_bytes = 256 * 1024;
+
+int HttpSession::sendResponse(Ref<HttpResponse> rsp)
+{
+    queueResponse(rsp);
+    return flush();
+}
+
+bool HttpSession::queueResponse(Ref<HttpResponse> rsp)
+{
+    size_t offset = m_head.size();
+    rsp->dumpHead(m_head);
+    m_outputs.push_back(Output{offset, m_head.size() - offset, rsp});
+    //文件body不占内存，不计入排队的字节数
+    m_outputSize += m_head.size() - offset + (rsp->getFileBody() ? 0 : rsp->getBody().size());
+    return m_outputs.size() < s_max_queued_responses && m_outputSize < s_max_queued_bytes;
+}
+
+int HttpSession::writeIovs(std::vector<iovec>& iovs)
+{
+    size_t index = 0;
+    while (index < iovs.size())
+    {
+        int len = getSocket()->send(&iovs[index], iovs.size() - index);
+        if (len <= 0)
+            return len;
+        //部分发送时跳过已经发完的iovec
+        size_t n = len;
+        while (n > 0)
         {
-            memcpy(&body[0], data, offset);
-            len = offset;
+            if (n >= iovs[index].iov_len)
+            {
+                n -= iovs[index].iov_len;
+                ++index;
+            }
+            else
+            {
+                iovs[index].iov_base = (char*)iovs[index].iov_base + n;
+                iovs[index].iov_len -= n;
+                n = 0;
+            }
         }
-        else
+        while (index < iovs.size() && iovs[index].iov_len == 0)
         {
-            memcpy(&body[0], data, length);
-            len = length;
+            ++index;
         }
-        length -= offset;
-        if (length > 0)
+    }
+    iovs.clear();
+    return 1;
+}
+
+//一次sendfile最多发送的字节数，避免一个大文件长时间占住线程
+static const size_t s_max_sendfile_size = 4 * 1024 * 1024;
+
+int HttpSession::writeFile(const HttpFileBody& file)
+{
+    int sock = getSocket()->getSocket();
+    off_t offset = file.offset;
+    uint64_t left = file.length;
+    while (left > 0)
+    {
+        //sendfile被hook，socket缓冲区满时让出协程等待可写
+        ssize_t len = sendfile(sock, file.fd, &offset, std::min(left, (uint64_t)s_max_sendfile_size));
+        if (len <= 0)
         {
-            if (readFixSize(&body[len], length) <= 0)
+            //文件被截断，已经发出的content-length无法满足
+            if (len == 0)
             {
-                close();
-                return nullptr;
+                TINY_LOG_WARN(logger) << "sendfile fd = " << file.fd << " offset = " << offset
+                    << " reached end of file, " << left << " bytes left";
             }
+            return len;
         }
-        parser->getData()->setBody(body);
+        left -= len;
     }
-    std::string keep_alive = parser->getData()->getHeader("Connection");
-    if (strcasecmp("keep-alive", keep_alive.c_str()) == 0)
+    return 1;
+}
+
+int HttpSession::flush()
+{
+    if (m_outputs.empty())
+        return 1;
+    std::vector<iovec> iovs;
+    iovs.reserve(m_outputs.size() * 2);
+    int res = m_outputSize;
+    for (auto& item : m_outputs)
     {
-        parser->getData()->setClose(false);
+        iovec iov;
+        iov.iov_base = &m_head[item.headOffset];
+        iov.iov_len = item.headLength;
+        iovs.push_back(iov);
+        auto file = item.rsp->getFileBody();
+        if (file)
+        {
+            //文件body之前的数据先writev出去，再用sendfile发文件
+            if (file->length == 0)
+                continue;
+            int len = writeIovs(iovs);
+            if (len > 0)
+                len = writeFile(*file);
+            if (len <= 0)
+            {
+                res = len;
+                break;
+            }
+            continue;
+        }
+        const std::string& body = item.rsp->getBody();
+        if (!body.empty())
+        {
+            iov.iov_base = (void*)body.data();
+            iov.iov_len = body.size();
+            iovs.push_back(iov);
+        }
+    }
+    if (res > 0 && !iovs.empty())
+    {
+        int len = writeIovs(iovs);
+        if (len <= 0)
+            res = len;
+    }
+    m_outputs.clear();
+    m_outputSize = 0;
+    m_head.clear();
+    if (m_head.capacity() > s_max_queued_bytes)
+    {
+        std::string().swap(m_head);
     }
-    return parser->getData();
+    return res;
 }
 
-void HttpSession::sendResponse(Ref<HttpResponse> rsp)
+bool HttpSession::hasBufferedRequest() const
 {
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    writeFixSize(data.c_str(), data.size());
+    if (m_bodyLeft > 0 || m_end - m_begin < 4)
+        return false;
+    return memmem(&m_buf[m_begin], m_end - m_begin, "\r\n\r\n", 4) != nullptr;
+}
+
+Ref<HttpChunkedStream> HttpSession::beginChunked(Ref<HttpResponse> rsp)
+{
+    bool chunked = rsp->getVersion() >= 0x11;
+    if (!chunked)
+    {
+        rsp->setClose(true);
+    }
+    Ref<HttpChunkedStream> stream(new HttpChunkedStream(shared_from_this(), chunked, m_headRequest));
+    rsp->setBodyStream(stream);
+    queueResponse(rsp);
+    if (flush() <= 0)
+    {
+        close();
+        return nullptr;
+    }
+    return stream;
 }
 
+HttpBodyStream::HttpBodyStream(Ref<HttpSession> session)
+    : m_session(session), m_requestCount(session->getRequestCount())
+{
 
 }
-}
\ No newline at end of file
+
+int HttpBodyStream::read(void* buffer, size_t length)
+{
+    //连接已经开始处理下一个请求
+    if (m_requestCount != m_session->getRequestCount())
+        return 0;
+    return m_session->readBody(buffer, length);
+}
+
+int HttpBodyStream::read(Ref<ByteArray> ba, size_t length)
+{
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    if (iovs.empty())
+        return 0;
+    int res = read(iovs[0].iov_base, iovs[0].iov_len);
+    if (res > 0)
+    {
+        ba->setPosition(ba->getPosition() + res);
+    }
+    return res;
+}
+
+HttpChunkedStream::HttpChunkedStream(Ref<HttpSession> session, bool chunked, bool discard)
+    : m_session(session), m_chunked(chunked), m_discard(discard)
+{
+
+}
+
+int HttpChunkedStream::send()
+{
+    int res = m_session->writeIovs(m_iovs);
+    m_iovs.clear();
+    if (res <= 0)
+    {
+        m_closed = true;
+        m_session->close();
+    }
+    return res;
+}
+
+int HttpChunkedStream::write(const void* buffer, size_t length)
+{
+    if (m_closed)
+        return -1;
+    //长度为0的chunk表示结束
+    if (length == 0)
+        return 0;
+    if (m_discard)
+        return length;
+    char size[24];
+    iovec iov;
+    if (m_chunked)
+    {
+        iov.iov_base = size;
+        iov.iov_len = snprintf(size, sizeof(size), "%zx\r\n", length);
+        m_iovs.push_back(iov);
+    }
+    iov.iov_base = (void*)buffer;
+    iov.iov_len = length;
+    m_iovs.push_back(iov);
+    if (m_chunked)
+    {
+        iov.iov_base = (void*)"\r\n";
+        iov.iov_len = 2;
+        m_iovs.push_back(iov);
+    }
+    int res = send();
+    return res > 0 ? length : res;
+}
+
+int HttpChunkedStream::write(Ref<ByteArray> ba, size_t length)
+{
+    if (m_closed)
+        return -1;
+    //ByteArray中可读的数据可能不足length，按实际取到的长度写chunk头
+    std::vector<iovec> data;
+    length = ba->getReadBuffers(data, length);
+    if (length == 0)
+        return 0;
+    if (m_discard)
+    {
+        ba->setPosition(ba->getPosition() + length);
+        return length;
+    }
+    char size[24];
+    iovec iov;
+    if (m_chunked)
+    {
+        iov.iov_base = size;
+        iov.iov_len = snprintf(size, sizeof(size), "%zx\r\n", length);
+        m_iovs.push_back(iov);
+    }
+    m_iovs.insert(m_iovs.end(), data.begin(), data.end());
+    if (m_chunked)
+    {
+        iov.iov_base = (void*)"\r\n";
+        iov.iov_len = 2;
+        m_iovs.push_back(iov);
+    }
+    int res = send();
+    if (res <= 0)
+        return res;
+    ba->setPosition(ba->getPosition() + length);
+    return length;
+}
+
+void HttpChunkedStream::close()
+{
+    if (m_closed)
+        return;
+    m_closed = true;
+    //HEAD响应只有头部，没有结束chunk
+    if (m_discard && m_chunked)
+        return;
+    if (!m_chunked)
+    {
+        //HTTP/1.0靠关闭连接表示body结束
+        m_session->close();
+        return;
+    }
+    iovec iov;
+    iov.iov_base = (void*)"0\r\n\r\n";
+    iov.iov_len = 5;
+    m_iovs.push_back(iov);
+    send();
+}
+
+}
+}
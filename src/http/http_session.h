@@ -1,21 +1,120 @@
 #pragma once
 #include "socket_stream.h"
 #include "http/http.h"
+#include <vector>
 
 namespace TinyServer
 {
 namespace http
 {
-class HttpSession : public SocketStream
+//连接上有一块复用的输入缓冲，读到的多余数据(下一个请求)保留到下一次recvRequest
+//头部最多读到http.request.max_header_size，body超过http.request.stream_body_size时
+//不预先读入，通过HttpRequest::getBodyStream按需读取
+//流水线(pipelining)的请求一次读进来后逐个解析，响应先用queueResponse排队，再用flush一次writev发出
+//流式响应用beginChunked先发出头部，body通过返回的HttpChunkedStream分块写出
+//发送时状态行和头部写入复用的缓冲，body作为单独的iovec，不拷贝，文件body用sendfile发送
+class HttpChunkedStream;
+
+class HttpSession : public SocketStream, public std::enable_shared_from_this<HttpSession>
 {
 public:
     HttpSession(Ref<Socket> sock, bool owner = true);
     Ref<HttpRequest> recvRequest();
-    void sendResponse(Ref<HttpResponse> rsp);
+    //立即发送(连同之前排队的响应)
+    int sendResponse(Ref<HttpResponse> rsp);
+    //排队等待flush，返回false表示队列已满需要先flush
+    bool queueResponse(Ref<HttpResponse> rsp);
+    //用一次writev发出所有排队的响应，失败返回<=0
+    int flush();
+    //输入缓冲中是否已经有一个完整的请求头(流水线中的下一个请求)
+    bool hasBufferedRequest() const;
+    //开始流式响应: 发出排队的响应和rsp的头部(transfer-encoding: chunked)，之后body写入返回的流
+    //必须在servlet的handle中写完，handle返回后自动补上结束chunk
+    //HTTP/1.0的请求不分块，body写完后关闭连接。HEAD请求只发头部，写入的body被丢弃。发送失败返回nullptr
+    Ref<HttpChunkedStream> beginChunked(Ref<HttpResponse> rsp);
+
+    //读取当前请求还没读走的body，返回0表示已经读完
+    int readBody(void* buffer, size_t length);
+    //当前请求还没读走的body长度
+    uint64_t getBodyLeft() const { return m_bodyLeft; }
+    //每次recvRequest递增，用来识别过期的body流
+    uint64_t getRequestCount() const { return m_requestCount; }
+
+private:
+    //从socket读一次追加到输入缓冲，缓冲满时先整理再扩容(不超过max_size)
+    int fill(size_t max_size);
+    //丢弃上一个请求没有读走的body
+    bool skipBody();
+    //请求超过限制或无法处理时回复status并关闭连接
+    void reject(HttpStatus status, uint8_t version);
+    //发送全部iovec(处理部分发送)，成功返回1并清空iovs
+    int writeIovs(std::vector<iovec>& iovs);
+    //用sendfile发送文件body
+    int writeFile(const HttpFileBody& file);
+
+private:
+    friend class HttpChunkedStream;
+    struct Output
+    {
+        size_t headOffset;          //在m_head中的位置
+        size_t headLength;
+        Ref<HttpResponse> rsp;      //body直接引用响应里的数据，发完之前保持引用
+    };
+    std::string m_head;             //排队响应的状态行和头部，连接内复用
+    std::vector<Output> m_outputs;
+    size_t m_outputSize = 0;
+    std::vector<char> m_buf;
+    size_t m_begin = 0;             //未处理数据的起始位置
+    size_t m_end = 0;               //未处理数据的结束位置
+    uint64_t m_bodyLeft = 0;
+    uint64_t m_requestCount = 0;
+    bool m_headRequest = false;     //当前请求是HEAD，流式响应不发body
+};
+
+//当前请求的body，先取输入缓冲中的数据，再直接从socket读取
+class HttpBodyStream : public Stream
+{
+public:
+    HttpBodyStream(Ref<HttpSession> session);
+
+    int read(void* buffer, size_t length) override;
+    int read(Ref<ByteArray> ba, size_t length) override;
+    int write(const void* buffer, size_t length) override { return -1; }
+    int write(Ref<ByteArray> ba, size_t length) override { return -1; }
+    void close() override {}
 
 private:
+    Ref<HttpSession> m_session;
+    uint64_t m_requestCount;
+};
+
+//流式响应的body，每次write发出一个chunk
+//write在数据全部写入socket后才返回，socket不可写时hook的sendmsg让出协程，慢客户端会反压servlet
+class HttpChunkedStream : public Stream
+{
+public:
+    //discard为true时(HEAD请求)write只返回长度，不发送数据
+    HttpChunkedStream(Ref<HttpSession> session, bool chunked, bool discard = false);
+
+    int read(void* buffer, size_t length) override { return -1; }
+    int read(Ref<ByteArray> ba, size_t length) override { return -1; }
+    int write(const void* buffer, size_t length) override;
+    int write(Ref<ByteArray> ba, size_t length) override;
+    //发出结束chunk，之后write返回-1，多次调用只生效一次
+    void close() override;
+    bool isClosed() const { return m_closed; }
+
+private:
+    //发出m_iovs，失败时关闭连接
+    int send();
+
+private:
+    Ref<HttpSession> m_session;
+    std::vector<iovec> m_iovs;
+    bool m_chunked;
+    bool m_discard;
+    bool m_closed = false;
 };
 
 }
 }
-
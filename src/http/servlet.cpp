@@ -1,5 +1,8 @@
 #include "http/servlet.h"
 #include <fnmatch.h>
+#include <string.h>
+#include "log.h"
+#include "macro.h"
 
 namespace TinyServer
 {
@@ -17,15 +20,244 @@ int32_t FunctionServlet::handle(Ref<HttpRequest> request, Ref<HttpResponse> resp
     return m_cb(request, response, session);
 }
         
+static Ref<Logger> logger = TINY_LOG_NAME("system");
+
+static const size_t NPOS = (size_t)-1;
+//一条路由最多的参数个数，查找时参数放在栈上的数组里
+static const size_t s_max_params = 16;
+
+//压缩前缀树的节点，静态前缀合并成一条边
+struct RouteNode
+{
+    std::string path;                                   //静态前缀，根节点和参数节点为空
+    std::string indices;                                //每个静态子节点path的首字符
+    std::vector<std::unique_ptr<RouteNode>> children;   //静态子节点
+    std::unique_ptr<RouteNode> param;                   //:name
+    size_t leaf = NPOS;                                 //在此结束的路由下标
+    size_t wildcard = NPOS;                             //在此结束的*name路由下标
+};
+
+struct Route
+{
+    std::string pattern;
+    Ref<Servlet> servlet;
+    std::vector<std::string> names;     //参数名，和匹配到的参数一一对应，省略名字的*为空
+};
+
+struct ServletDispatch::RouteTable
+{
+    //uri(/xxx/xxx) -> servlet
+    std::unordered_map<std::string, Ref<Servlet>> datas;
+    //uri(/xxx/*) ->servlet，按注册顺序
+    std::vector<std::pair<std::string, Ref<Servlet>>> globs;
+    //addRoute注册的路由，按注册顺序
+    std::vector<Route> routes;
+
+    //以下由build根据上面的数据生成
+    RouteNode routeTree;
+    RouteNode globTree;                 //形如"字面量*"的glob等价于前缀匹配，放进前缀树
+    std::vector<size_t> complexGlobs;   //其余glob的下标，仍然用fnmatch
+
+    void build();
+};
+
+//从node开始插入一段静态字符串，必要时拆分已有的边，返回字符串结束处的节点
+static RouteNode* InsertStatic(RouteNode* node, const char* str, size_t len)
+{
+    while (len > 0)
+    {
+        size_t pos = node->indices.find(str[0]);
+        if (pos == std::string::npos)
+        {
+            RouteNode* child = new RouteNode;
+            child->path.assign(str, len);
+            node->indices.push_back(str[0]);
+            node->children.emplace_back(child);
+            return child;
+        }
+        RouteNode* child = node->children[pos].get();
+        size_t common = 1;
+        size_t max = std::min(len, child->path.size());
+        while (common < max && child->path[common] == str[common])
+        {
+            ++common;
+        }
+        if (common < child->path.size())
+        {
+            //公共前缀作为新节点，原来的子节点保留剩下的部分
+            std::unique_ptr<RouteNode> split(new RouteNode);
+            split->path = child->path.substr(0, common);
+            child->path.erase(0, common);
+            split->indices.push_back(child->path[0]);
+            split->children.push_back(std::move(node->children[pos]));
+            node->children[pos] = std::move(split);
+            child = node->children[pos].get();
+        }
+        node = child;
+        str += common;
+        len -= common;
+    }
+    return node;
+}
+
+//校验路由模式并取出参数名，:name和*name必须在段首，*name只能在最后一段
+static bool ParseRoute(const std::string& pattern, std::vector<std::string>& names)
+{
+    if (pattern.empty() || pattern[0] != '/')
+        return false;
+    size_t pos = 0;
+    while ((pos = pattern.find_first_of(":*", pos)) != std::string::npos)
+    {
+        if (pattern[pos - 1] != '/')
+            return false;
+        size_t end = pattern.find('/', pos);
+        if (end == std::string::npos)
+            end = pattern.size();
+        std::string name = pattern.substr(pos + 1, end - pos - 1);
+        if (name.find_first_of(":*") != std::string::npos)
+            return false;
+        if (pattern[pos] == ':' && name.empty())
+            return false;
+        if (pattern[pos] == '*' && end != pattern.size())
+            return false;
+        names.push_back(name);
+        if (names.size() > s_max_params)
+            return false;
+        pos = end;
+    }
+    return true;
+}
+
+//pattern已经由ParseRoute校验过，返回被覆盖的路由下标
+static size_t InsertRoute(RouteNode* root, const std::string& pattern, size_t index)
+{
+    RouteNode* node = root;
+    size_t i = 0;
+    while (true)
+    {
+        size_t pos = pattern.find_first_of(":*", i);
+        if (pos == std::string::npos)
+            pos = pattern.size();
+        node = InsertStatic(node, pattern.data() + i, pos - i);
+        if (pos == pattern.size())
+            break;
+        if (pattern[pos] == '*')
+        {
+            std::swap(node->wildcard, index);
+            return index;
+        }
+        if (!node->param)
+            node->param.reset(new RouteNode);
+        node = node->param.get();
+        i = pattern.find('/', pos);
+        if (i == std::string::npos)
+            break;
+    }
+    std::swap(node->leaf, index);
+    return index;
+}
+
+struct Capture
+{
+    const char* data;
+    size_t len;
+};
+
+//node自身的path已经匹配，p为剩余部分，失败时回溯
+static size_t MatchRoute(const RouteNode* node, const char* p, size_t len, Capture* caps, size_t depth)
+{
+    if (len == 0 && node->leaf != NPOS)
+        return node->leaf;
+    if (len > 0)
+    {
+        const char* c = (const char*)memchr(node->indices.data(), p[0], node->indices.size());
+        if (c)
+        {
+            const RouteNode* child = node->children[c - node->indices.data()].get();
+            size_t n = child->path.size();
+            if (len >= n && !memcmp(p, child->path.data(), n))
+            {
+                size_t res = MatchRoute(child, p + n, len - n, caps, depth);
+                if (res != NPOS)
+                    return res;
+            }
+        }
+        if (node->param && p[0] != '/' && depth < s_max_params)
+        {
+            const char* slash = (const char*)memchr(p, '/', len);
+            size_t n = slash ? slash - p : len;
+            caps[depth] = Capture{p, n};
+            size_t res = MatchRoute(node->param.get(), p + n, len - n, caps, depth + 1);
+            if (res != NPOS)
+                return res;
+        }
+    }
+    if (node->wildcard != NPOS && depth < s_max_params)
+    {
+        caps[depth] = Capture{p, len};
+        return node->wildcard;
+    }
+    return NPOS;
+}
+
+//沿着uri走前缀树，返回经过的节点中最小的glob下标
+static size_t MatchGlobPrefix(const RouteNode* node, const char* p, size_t len)
+{
+    size_t best = node->leaf;
+    while (len > 0)
+    {
+        const char* c = (const char*)memchr(node->indices.data(), p[0], node->indices.size());
+        if (!c)
+            break;
+        node = node->children[c - node->indices.data()].get();
+        size_t n = node->path.size();
+        if (len < n || memcmp(p, node->path.data(), n))
+            break;
+        p += n;
+        len -= n;
+        best = std::min(best, node->leaf);
+    }
+    return best;
+}
+
+void ServletDispatch::RouteTable::build()
+{
+    for (size_t i = 0; i < routes.size(); ++i)
+    {
+        size_t old = InsertRoute(&routeTree, routes[i].pattern, i);
+        if (old != NPOS)
+        {
+            //形状相同的路由(如/a/:id和/a/:name)后注册的生效
+            TINY_LOG_WARN(logger) << "route " << routes[i].pattern << " overrides " << routes[old].pattern;
+        }
+    }
+    for (size_t i = 0; i < globs.size(); ++i)
+    {
+        const std::string& pattern = globs[i].first;
+        if (!pattern.empty() && pattern.find_first_of("*?[\\") == pattern.size() - 1 
+            && pattern.back() == '*')
+        {
+            RouteNode* node = InsertStatic(&globTree, pattern.data(), pattern.size() - 1);
+            node->leaf = std::min(node->leaf, i);
+        }
+        else
+        {
+            complexGlobs.push_back(i);
+        }
+    }
+}
+
+static std::atomic<uint64_t> s_dispatch_id = {0};
+
 ServletDispatch::ServletDispatch()
-    : Servlet("ServletDispatch")
+    : Servlet("ServletDispatch"), m_table(new RouteTable), m_version(0), m_id(++s_dispatch_id)
 {
     m_default.reset((new NotFountServlet()));
 }
 
 int32_t ServletDispatch::handle(Ref<HttpRequest> request, Ref<HttpResponse> response, Ref<HttpSession> session)
 {
-    auto slt = getMatchedServlet(request->getPath());
+    auto slt = getMatchedServlet(request->getPath(), request);
     if (slt)
     {
         slt->handle(request, response, session);
@@ -33,30 +265,81 @@ int32_t ServletDispatch::handle(Ref<HttpRequest> request, Ref<HttpResponse> resp
     return 0;
 }
 
+void ServletDispatch::update(const std::function<void(RouteTable& table)>& cb)
+{
+    MutexType::MutexLockGuard lock(m_mutex);
+    Ref<RouteTable> table(new RouteTable);
+    table->datas = m_table->datas;
+    table->globs = m_table->globs;
+    table->routes = m_table->routes;
+    cb(*table);
+    table->build();
+    m_table = table;
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+//每个线程缓存最近用到的几个ServletDispatch的路由表
+//已经析构的ServletDispatch的表会留到被挤出缓存或线程退出
+struct RouteTableCache
+{
+    uint64_t id;
+    uint64_t version;
+    Ref<const ServletDispatch::RouteTable> table;
+};
+
+static thread_local std::vector<RouteTableCache> t_route_caches;
+static const size_t s_max_route_caches = 8;
+
+const ServletDispatch::RouteTable* ServletDispatch::getTable()
+{
+    uint64_t version = m_version.load(std::memory_order_acquire);
+    for (auto& item : t_route_caches)
+    {
+        if (item.id == m_id)
+        {
+            if (TINY_UNLICKLY(item.version != version))
+            {
+                MutexType::MutexLockGuard lock(m_mutex);
+                item.table = m_table;
+                item.version = m_version.load(std::memory_order_relaxed);
+            }
+            return item.table.get();
+        }
+    }
+    if (t_route_caches.size() >= s_max_route_caches)
+    {
+        t_route_caches.erase(t_route_caches.begin());
+    }
+    MutexType::MutexLockGuard lock(m_mutex);
+    t_route_caches.push_back(RouteTableCache{m_id, m_version.load(std::memory_order_relaxed), m_table});
+    return t_route_caches.back().table.get();
+}
+
 void ServletDispatch::addServlet(const std::string& uri, Ref<Servlet> slt)
 {
-    RWMutexType::WriteLockGuard lock(m_mutex);
-    m_datas[uri] = slt;
+    update([&uri, &slt](RouteTable& table){
+        table.datas[uri] = slt;
+    });
 }
 
 void ServletDispatch::addServlet(const std::string& uri, FunctionServlet::Callback cb)
 {
-    RWMutexType::WriteLockGuard lock(m_mutex);
-    m_datas[uri].reset(new FunctionServlet(cb));
+    addServlet(uri, Ref<FunctionServlet>(new FunctionServlet(cb)));
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri, Ref<Servlet> slt)
 {
-    RWMutexType::WriteLockGuard lock(m_mutex);
-    for (auto iter = m_globs.begin(); iter != m_globs.end(); ++iter)
-    {
-        if (iter->first == uri)
+    update([&uri, &slt](RouteTable& table){
+        for (auto iter = table.globs.begin(); iter != table.globs.end(); ++iter)
         {
-            m_globs.erase(iter);
-            break;
+            if (iter->first == uri)
+            {
+                table.globs.erase(iter);
+                break;
+            }
         }
-    }
-    m_globs.push_back(std::make_pair(uri, slt));
+        table.globs.push_back(std::make_pair(uri, slt));
+    });
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri, FunctionServlet::Callback cb)
@@ -64,36 +347,80 @@ void ServletDispatch::addGlobServlet(const std::string& uri, FunctionServlet::Ca
     addGlobServlet(uri, Ref<FunctionServlet>(new FunctionServlet(cb)));
 }
 
+void ServletDispatch::addRoute(const std::string& pattern, Ref<Servlet> slt)
+{
+    Route route;
+    route.pattern = pattern;
+    route.servlet = slt;
+    if (!ParseRoute(pattern, route.names))
+    {
+        TINY_LOG_ERROR(logger) << "addRoute invalid pattern " << pattern;
+        return;
+    }
+    update([&route](RouteTable& table){
+        for (auto& item : table.routes)
+        {
+            if (item.pattern == route.pattern)
+            {
+                item = route;
+                return;
+            }
+        }
+        table.routes.push_back(route);
+    });
+}
+
+void ServletDispatch::addRoute(const std::string& pattern, FunctionServlet::Callback cb)
+{
+    addRoute(pattern, Ref<FunctionServlet>(new FunctionServlet(cb)));
+}
+
 void ServletDispatch::delServlet(const std::string& uri)
 {
-    RWMutexType::WriteLockGuard lock(m_mutex);
-    m_datas.erase(uri);
+    update([&uri](RouteTable& table){
+        table.datas.erase(uri);
+    });
 }
 
 void ServletDispatch::delGlobServlet(const std::string& uri)
 {
-    RWMutexType::WriteLockGuard lock(m_mutex);
-    for (auto iter = m_globs.begin(); iter != m_globs.end(); ++iter)
-    {
-        if (iter->first == uri)
+    update([&uri](RouteTable& table){
+        for (auto iter = table.globs.begin(); iter != table.globs.end(); ++iter)
         {
-            m_globs.erase(iter);
-            break;
+            if (iter->first == uri)
+            {
+                table.globs.erase(iter);
+                break;
+            }
         }
-    }
+    });
+}
+
+void ServletDispatch::delRoute(const std::string& pattern)
+{
+    update([&pattern](RouteTable& table){
+        for (auto iter = table.routes.begin(); iter != table.routes.end(); ++iter)
+        {
+            if (iter->pattern == pattern)
+            {
+                table.routes.erase(iter);
+                break;
+            }
+        }
+    });
 }
 
 Ref<Servlet> ServletDispatch::getServlet(const std::string& uri)
 {
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    auto iter = m_datas.find(uri);
-    return iter == m_datas.end() ? nullptr : iter->second;
+    const RouteTable* table = getTable();
+    auto iter = table->datas.find(uri);
+    return iter == table->datas.end() ? nullptr : iter->second;
 }
 
 Ref<Servlet> ServletDispatch::getGlobServlet(const std::string& uri)
 {
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    for (auto iter = m_globs.begin(); iter != m_globs.end(); ++iter)
+    const RouteTable* table = getTable();
+    for (auto iter = table->globs.begin(); iter != table->globs.end(); ++iter)
     {
         if (iter->first == uri)
             return iter->second;
@@ -101,18 +428,56 @@ Ref<Servlet> ServletDispatch::getGlobServlet(const std::string& uri)
     return nullptr;
 }
 
+Ref<Servlet> ServletDispatch::getRoute(const std::string& pattern)
+{
+    const RouteTable* table = getTable();
+    for (auto& item : table->routes)
+    {
+        if (item.pattern == pattern)
+            return item.servlet;
+    }
+    return nullptr;
+}
+
 Ref<Servlet> ServletDispatch::getMatchedServlet(const std::string& uri)
 {
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    auto iter = m_datas.find(uri);
-    if (iter != m_datas.end())
+    return getMatchedServlet(uri, nullptr);
+}
+
+Ref<Servlet> ServletDispatch::getMatchedServlet(const std::string& uri, Ref<HttpRequest> request)
+{
+    const RouteTable* table = getTable();
+    auto iter = table->datas.find(uri);
+    if (iter != table->datas.end())
         return iter->second;
-    for (auto iter = m_globs.begin(); iter != m_globs.end(); ++iter)
+    if (!table->routes.empty())
     {
-        if (!fnmatch(iter->first.c_str(), uri.c_str(), 0))
-            return iter->second;
+        Capture caps[s_max_params];
+        size_t index = MatchRoute(&table->routeTree, uri.data(), uri.size(), caps, 0);
+        if (index != NPOS)
+        {
+            const Route& route = table->routes[index];
+            for (size_t i = 0; request && i < route.names.size(); ++i)
+            {
+                if (!route.names[i].empty())
+                    request->setParam(route.names[i], std::string(caps[i].data, caps[i].len));
+            }
+            return route.servlet;
+        }
+    }
+    //前缀glob和其他glob中注册最早的一个，和逐个fnmatch的结果一致
+    size_t best = MatchGlobPrefix(&table->globTree, uri.data(), uri.size());
+    for (size_t i : table->complexGlobs)
+    {
+        if (i >= best)
+            break;
+        if (!fnmatch(table->globs[i].first.c_str(), uri.c_str(), 0))
+        {
+            best = i;
+            break;
+        }
     }
-    return m_default;
+    return best == NPOS ? m_default : table->globs[best].second;
 }
 
 NotFountServlet::NotFountServlet()
@@ -123,9 +488,11 @@ NotFountServlet::NotFountServlet()
 
 int32_t NotFountServlet::handle(Ref<HttpRequest> request, Ref<HttpResponse> response, Ref<HttpSession> session)
 {
-    static const std::string& RSP_BODY = "<html><head><title>404 Not Found"
+    //所有404响应共用一份body
+    static const Ref<const std::string> RSP_BODY = std::make_shared<const std::string>(
+        "<html><head><title>404 Not Found"
         "</title></head><body><center><h1>404 Not Found</h1></center>"
-        "<hr><center>TinyServer/1.0.0</center></body></html>";
+        "<hr><center>TinyServer/1.0.0</center></body></html>");
     response->setStatus(HttpStatus::NOT_FOUND);
     response->setHeader("Server", "TinyServer/1.0.0");
     response->setHeader("Content-Type", "text/html");
@@ -5,6 +5,7 @@
 #include "http/http_session.h"
 #include "thread.h"
 #include <unordered_map>
+#include <atomic>
 
 
 namespace TinyServer
@@ -43,10 +44,13 @@ private:
     Callback m_cb;
 };
 
+//匹配顺序: 精确uri -> 路由(addRoute) -> glob(按注册顺序第一个匹配的) -> 默认
+//所有路由数据放在一张不可变的路由表里，修改时复制一份再发布(copy-on-write)
+//查找不加锁: 每个线程缓存当前路由表，版本号没变时只有一次原子读
 class ServletDispatch : public Servlet
 {
 public:
-    typedef RWLock RWMutexType;
+    typedef MutexLock MutexType;
     ServletDispatch();
     int32_t handle(Ref<HttpRequest> request, 
         Ref<HttpResponse> response, 
@@ -58,23 +62,40 @@ public:
     void addGlobServlet(const std::string& uri, Ref<Servlet> slt);
     void addGlobServlet(const std::string& uri, FunctionServlet::Callback cb);
 
+    //路由模式: 静态段、:name匹配一个非空的段、末尾的*name匹配剩余部分(可以为空，name可省略)
+    //例如 /user/:id/profile、/static/*path，匹配到的参数通过HttpRequest::setParam写入请求
+    //优先级: 静态段 > :name > *name
+    void addRoute(const std::string& pattern, Ref<Servlet> slt);
+    void addRoute(const std::string& pattern, FunctionServlet::Callback cb);
+
     void delServlet(const std::string& uri);
     void delGlobServlet(const std::string& uri);
+    void delRoute(const std::string& pattern);
 
     Ref<Servlet> getServlet(const std::string& uri);
     Ref<Servlet> getGlobServlet(const std::string& uri);
+    Ref<Servlet> getRoute(const std::string& pattern);
 
     Ref<Servlet> getDefault() const { return m_default; }
     void setDefault(Ref<Servlet> v) { m_default = v; }
 
     Ref<Servlet> getMatchedServlet(const std::string& uri);
+    //request不为空时把路由参数写入request
+    Ref<Servlet> getMatchedServlet(const std::string& uri, Ref<HttpRequest> request);
+
+    struct RouteTable;
+
+private:
+    //在新复制的路由表上执行cb，然后发布
+    void update(const std::function<void(RouteTable& table)>& cb);
+    //当前线程缓存的路由表
+    const RouteTable* getTable();
 
 private:
-    RWMutexType m_mutex;
-    //uri(/xxx/xxx) -> servlet
-    std::unordered_map<std::string, Ref<Servlet>> m_datas;
-    //uri(/xxx/*) ->servlet
-    std::vector<std::pair<std::string, Ref<Servlet>>> m_globs;
+    MutexType m_mutex;
+    Ref<const RouteTable> m_table;
+    std::atomic<uint64_t> m_version;
+    uint64_t m_id;              //区分线程局部缓存属于哪个ServletDispatch
     //默认servlet，所有路径都没有匹配
     Ref<Servlet> m_default;
 };
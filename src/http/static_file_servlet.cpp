@@ -0,0 +1,425 @@
+#include "http/static_file_servlet.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+
+namespace TinyServer
+{
+namespace http
+{
+
+static Ref<Logger> logger = TINY_LOG_NAME("system");
+
+static Ref<ConfigVar<uint64_t>> g_static_fd_cache_size =
+    Config::Lookup("http.static.fd_cache_size", (uint64_t)1024, "static file open fd cache size");
+
+static Ref<ConfigVar<uint64_t>> g_static_stat_interval =
+    Config::Lookup("http.static.stat_interval", (uint64_t)1000, "static file stat check interval ms");
+
+//HTTP日期格式(RFC 7231 IMF-fixdate)
+static const char* s_http_date_format = "%a, %d %b %Y %H:%M:%S GMT";
+
+static std::string FormatHttpDate(time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), s_http_date_format, &tm);
+    return std::string(buf, n);
+}
+
+static bool ParseHttpDate(const std::string& str, time_t& t)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(str.c_str(), s_http_date_format, &tm);
+    if (!end || *end)
+        return false;
+    t = timegm(&tm);
+    return true;
+}
+
+static bool SameFile(const struct stat& a, const struct stat& b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size
+        && a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+FileCache::Entry::~Entry()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+FileCache::FileCache(size_t max_size)
+    : m_maxSize(std::max(max_size, (size_t)1))
+{
+
+}
+
+Ref<FileCache::Entry> FileCache::Open(const std::string& path)
+{
+    //O_NONBLOCK防止打开FIFO时阻塞，对普通文件没有影响
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    Ref<Entry> entry(new Entry);
+    entry->fd = fd;
+    if (fstat(fd, &entry->st) != 0)
+        return nullptr;
+    if (!S_ISREG(entry->st.st_mode))
+    {
+        errno = S_ISDIR(entry->st.st_mode) ? EISDIR : EACCES;
+        return nullptr;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx\"", (unsigned long)entry->st.st_mtim.tv_sec,
+        (unsigned long)entry->st.st_size);
+    entry->etag = buf;
+    entry->lastModified = FormatHttpDate(entry->st.st_mtim.tv_sec);
+    return entry;
+}
+
+Ref<const FileCache::Entry> FileCache::get(const std::string& path)
+{
+    uint64_t now = GetCurrentMs();
+    Ref<const Entry> old;
+    {
+        MutexType::MutexLockGuard lock(m_mutex);
+        auto it = m_nodes.find(path);
+        if (it != m_nodes.end())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            if (now - it->second->checkTime < g_static_stat_interval->getValue())
+                return it->second->entry;
+            old = it->second->entry;
+        }
+    }
+
+    //stat和open不持锁
+    if (old)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && SameFile(st, old->st))
+        {
+            MutexType::MutexLockGuard lock(m_mutex);
+            auto it = m_nodes.find(path);
+            if (it != m_nodes.end() && it->second->entry == old)
+                it->second->checkTime = now;
+            return old;
+        }
+    }
+    Ref<const Entry> entry = Open(path);
+    int error = errno;
+    MutexType::MutexLockGuard lock(m_mutex);
+    auto it = m_nodes.find(path);
+    if (!entry)
+    {
+        if (it != m_nodes.end())
+        {
+            m_lru.erase(it->second);
+            m_nodes.erase(it);
+        }
+        errno = error;
+        return nullptr;
+    }
+    if (it != m_nodes.end())
+    {
+        it->second->entry = entry;
+        it->second->checkTime = now;
+        return entry;
+    }
+    m_lru.push_front(Node{path, entry, now});
+    m_nodes[path] = m_lru.begin();
+    while (m_lru.size() > m_maxSize)
+    {
+        m_nodes.erase(m_lru.back().path);
+        m_lru.pop_back();
+    }
+    return entry;
+}
+
+size_t FileCache::size()
+{
+    MutexType::MutexLockGuard lock(m_mutex);
+    return m_lru.size();
+}
+
+void FileCache::clear()
+{
+    MutexType::MutexLockGuard lock(m_mutex);
+    m_nodes.clear();
+    m_lru.clear();
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+//解码%XX并检查路径，不允许出现..段和\0
+static bool DecodePath(const std::string& uri, std::string& path)
+{
+    path.clear();
+    path.reserve(uri.size());
+    for (size_t i = 0; i < uri.size(); ++i)
+    {
+        char c = uri[i];
+        if (c == '%')
+        {
+            int hi = i + 2 < uri.size() ? HexValue(uri[i + 1]) : -1;
+            int lo = hi >= 0 ? HexValue(uri[i + 2]) : -1;
+            if (lo < 0)
+                return false;
+            c = (char)(hi * 16 + lo);
+            i += 2;
+        }
+        if (c == '\0')
+            return false;
+        path.push_back(c);
+    }
+    size_t pos = 0;
+    while (pos <= path.size())
+    {
+        size_t end = path.find('/', pos);
+        if (end == std::string::npos)
+            end = path.size();
+        if (end - pos == 2 && path[pos] == '.' && path[pos + 1] == '.')
+            return false;
+        pos = end + 1;
+    }
+    return true;
+}
+
+static const char* GetContentType(const std::string& path)
+{
+    static const struct
+    {
+        const char* ext;
+        const char* type;
+    } s_types[] = {
+        {"html", "text/html"},
+        {"htm", "text/html"},
+        {"css", "text/css"},
+        {"js", "application/javascript"},
+        {"json", "application/json"},
+        {"txt", "text/plain"},
+        {"xml", "text/xml"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"svg", "image/svg+xml"},
+        {"ico", "image/x-icon"},
+        {"webp", "image/webp"},
+        {"wasm", "application/wasm"},
+        {"pdf", "application/pdf"},
+        {"mp4", "video/mp4"},
+    };
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+    {
+        const char* ext = path.c_str() + dot + 1;
+        for (auto& item : s_types)
+        {
+            if (strcasecmp(ext, item.ext) == 0)
+                return item.type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+//If-None-Match是逗号分隔的etag列表或*，按弱比较匹配
+static bool MatchETag(const std::string& header, const std::string& etag)
+{
+    size_t pos = 0;
+    while (pos < header.size())
+    {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos)
+            end = header.size();
+        size_t b = header.find_first_not_of(" \t", pos);
+        size_t e = header.find_last_not_of(" \t", end - 1);
+        if (b != std::string::npos && b < end && e >= b)
+        {
+            if (e - b + 1 > 2 && header[b] == 'W' && header[b + 1] == '/')
+                b += 2;
+            if (header.compare(b, e - b + 1, "*") == 0 || header.compare(b, e - b + 1, etag) == 0)
+                return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+//只支持单个区间: bytes=a-b、bytes=a-、bytes=-n
+//返回1表示区间有效，0表示忽略Range(格式不对或多个区间)返回整个文件，-1表示区间不可满足
+static int ParseRange(const std::string& header, uint64_t size, uint64_t& begin, uint64_t& end)
+{
+    if (strncasecmp(header.c_str(), "bytes=", 6) != 0)
+        return 0;
+    std::string spec = header.substr(6);
+    if (spec.find(',') != std::string::npos)
+        return 0;
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos)
+        return 0;
+    std::string first = spec.substr(0, dash);
+    std::string last = spec.substr(dash + 1);
+    if (first.find_first_not_of("0123456789") != std::string::npos
+        || last.find_first_not_of("0123456789") != std::string::npos)
+        return 0;
+    if (first.empty())
+    {
+        if (last.empty())
+            return 0;
+        uint64_t suffix = strtoull(last.c_str(), nullptr, 10);
+        if (suffix == 0 || size == 0)
+            return -1;
+        begin = size - std::min(suffix, size);
+        end = size - 1;
+        return 1;
+    }
+    begin = strtoull(first.c_str(), nullptr, 10);
+    end = last.empty() ? size - 1 : strtoull(last.c_str(), nullptr, 10);
+    if (!last.empty() && end < begin)
+        return 0;
+    if (begin >= size)
+        return -1;
+    end = std::min(end, size - 1);
+    return 1;
+}
+
+StaticFileServlet::StaticFileServlet(const std::string& prefix, const std::string& root)
+    : Servlet("StaticFileServlet"), m_prefix(prefix), m_root(root)
+    , m_cache(g_static_fd_cache_size->getValue())
+{
+    while (m_root.size() > 1 && m_root.back() == '/')
+    {
+        m_root.pop_back();
+    }
+}
+
+int32_t StaticFileServlet::handle(Ref<HttpRequest> request, Ref<HttpResponse> response, Ref<HttpSession> session)
+{
+    HttpMethod method = request->getMethod();
+    if (method != HttpMethod::GET && method != HttpMethod::HEAD)
+    {
+        response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+        response->setHeader("Allow", "GET, HEAD");
+        return 0;
+    }
+
+    const std::string& uri = request->getPath();
+    std::string path;
+    if (uri.compare(0, m_prefix.size(), m_prefix) != 0
+        || !DecodePath(uri.substr(m_prefix.size()), path))
+    {
+        response->setStatus(HttpStatus::FORBIDDEN);
+        return 0;
+    }
+    if (path.empty() || path.back() == '/')
+        path.append("index.html");
+    if (path[0] != '/')
+        path.insert(path.begin(), '/');
+    path.insert(0, m_root);
+
+    Ref<const FileCache::Entry> entry = m_cache.get(path);
+    if (!entry)
+    {
+        if (errno == EACCES)
+        {
+            response->setStatus(HttpStatus::FORBIDDEN);
+        }
+        else
+        {
+            response->setStatus(HttpStatus::NOT_FOUND);
+        }
+        TINY_LOG_DEBUG(logger) << "static file " << path << " errno = " << errno
+            << " errstr = " << strerror(errno);
+        return 0;
+    }
+
+    response->setHeader(HttpHeader::ETAG, entry->etag);
+    response->setHeader(HttpHeader::LAST_MODIFIED, entry->lastModified);
+    response->setHeader("Accept-Ranges", "bytes");
+
+    //有If-None-Match时忽略If-Modified-Since
+    std::string none_match = request->getHeader(HttpHeader::IF_NONE_MATCH);
+    if (!none_match.empty())
+    {
+        if (MatchETag(none_match, entry->etag))
+        {
+            response->setStatus(HttpStatus::NOT_MODIFIED);
+            return 0;
+        }
+    }
+    else
+    {
+        time_t since = 0;
+        if (ParseHttpDate(request->getHeader(HttpHeader::IF_MODIFIED_SINCE), since)
+            && entry->st.st_mtim.tv_sec <= since)
+        {
+            response->setStatus(HttpStatus::NOT_MODIFIED);
+            return 0;
+        }
+    }
+
+    uint64_t size = entry->st.st_size;
+    uint64_t begin = 0;
+    uint64_t end = size - 1;
+    std::string range = request->getHeader(HttpHeader::RANGE);
+    std::string if_range = request->getHeader(HttpHeader::IF_RANGE);
+    //If-Range和当前文件不一致时返回整个文件
+    if (!range.empty() && (if_range.empty() || if_range == entry->etag || if_range == entry->lastModified))
+    {
+        int res = ParseRange(range, size, begin, end);
+        if (res < 0)
+        {
+            response->setStatus(HttpStatus::RANGE_NOT_SATISFIABLE);
+            response->setHeader(HttpHeader::CONTENT_RANGE, "bytes */" + std::to_string(size));
+            return 0;
+        }
+        if (res > 0)
+        {
+            response->setStatus(HttpStatus::PARTIAL_CONTENT);
+            response->setHeader(HttpHeader::CONTENT_RANGE, "bytes " + std::to_string(begin) + "-"
+                + std::to_string(end) + "/" + std::to_string(size));
+        }
+        else
+        {
+            begin = 0;
+            end = size - 1;
+        }
+    }
+    response->setHeader(HttpHeader::CONTENT_TYPE, GetContentType(path));
+
+    uint64_t length = size == 0 ? 0 : end - begin + 1;
+    if (method == HttpMethod::HEAD)
+    {
+        response->setHeader(HttpHeader::CONTENT_LENGTH, std::to_string(length));
+        return 0;
+    }
+    std::shared_ptr<HttpFileBody> body(new HttpFileBody);
+    body->holder = entry;
+    body->fd = entry->fd;
+    body->offset = begin;
+    body->length = length;
+    response->setFileBody(body);
+    return 0;
+}
+
+}
+}
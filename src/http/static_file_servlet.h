@@ -0,0 +1,70 @@
+#pragma once
+#include "http/servlet.h"
+#include "thread.h"
+#include <list>
+#include <unordered_map>
+#include <sys/stat.h>
+
+namespace TinyServer
+{
+namespace http
+{
+//缓存打开的文件fd和stat结果，超过容量时淘汰最久没有用到的
+//距离上次stat超过http.static.stat_interval毫秒时重新stat，文件变化了就重新打开
+//被淘汰的文件如果还在发送，fd在最后一个引用释放时才关闭
+class FileCache
+{
+public:
+    typedef MutexLock MutexType;
+    struct Entry
+    {
+        ~Entry();
+        int fd = -1;
+        struct stat st;
+        std::string etag;
+        std::string lastModified;
+    };
+
+    FileCache(size_t max_size);
+    //不存在或不是普通文件时返回nullptr，errno表示原因
+    Ref<const Entry> get(const std::string& path);
+    size_t size();
+    void clear();
+
+private:
+    static Ref<Entry> Open(const std::string& path);
+
+private:
+    struct Node
+    {
+        std::string path;
+        Ref<const Entry> entry;
+        uint64_t checkTime;     //上次stat的时间(ms)
+    };
+    MutexType m_mutex;
+    size_t m_maxSize;
+    std::list<Node> m_lru;      //最近用到的在前面
+    std::unordered_map<std::string, std::list<Node>::iterator> m_nodes;
+};
+
+//把uri去掉prefix后的部分映射到root目录下的文件，只支持GET和HEAD
+//body通过sendfile发送，支持单个区间的Range、If-Range、If-None-Match和If-Modified-Since
+//例如 dispatch->addGlobServlet("/static/*", Ref<Servlet>(new StaticFileServlet("/static/", "/var/www")))
+class StaticFileServlet : public Servlet
+{
+public:
+    StaticFileServlet(const std::string& prefix, const std::string& root);
+    int32_t handle(Ref<HttpRequest> request,
+        Ref<HttpResponse> response,
+        Ref<HttpSession> session) override;
+
+    FileCache& getCache() { return m_cache; }
+
+private:
+    std::string m_prefix;
+    std::string m_root;
+    FileCache m_cache;
+};
+
+}
+}
@@ -1,37 +1,80 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
+#include "uring.h"
 #include <sys/epoll.h>
 #include <unistd.h>
-//#include <fcntl.h>
+#include <sys/eventfd.h>
 #include <string.h>
 
 namespace TinyServer
 {
 static Ref<Logger> logger = TINY_LOG_NAME("system");
 
+static Ref<ConfigVar<int>> iomanager_epoll_batch_size = Config::Lookup("iomanager.epoll.batch_size", 
+    256, "max events returned by one epoll_wait");
+
+static Ref<ConfigVar<bool>> iomanager_io_uring_enable = Config::Lookup("iomanager.io_uring.enable", 
+    false, "submit hooked socket io through io_uring when the kernel supports it, otherwise use epoll");
+
+static Ref<ConfigVar<int>> iomanager_io_uring_entries = Config::Lookup("iomanager.io_uring.entries", 
+    256, "io_uring submission queue size");
+
+static Ref<ConfigVar<bool>> iomanager_epoll_persistent = Config::Lookup("iomanager.epoll.persistent", 
+    false, "keep fds registered edge-triggered for both directions instead of re-arming per event");
 
 IOManager::IOManager(size_t threads, bool use_call, const std::string& name)
     : Scheduler(threads, use_call, name)
+    , m_persistent(iomanager_epoll_persistent->getValue())
+    , m_batchSize(std::max(1, iomanager_epoll_batch_size->getValue()))
 {
     m_epollfd = epoll_create(5000);
     TINY_ASSERT(m_epollfd >= 0);
 
-    //int res = pipe(m_ticklefd);
-    //TINY_ASSERT(res == 0);
-
-    //epoll_event event;
-    //memset(&event, 0, sizeof(event));
-    //event.events = EPOLLIN | EPOLLET;
-    //event.data.fd = m_ticklefd[0];
+    m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    TINY_ASSERT(m_tickleFd >= 0);
 
-    //res = fcntl(m_ticklefd[0], F_SETFL, O_NONBLOCK);
-    //TINY_ASSERT(res >= 0);
+    //边缘触发: 每次写入只唤醒一个epoll_wait中的线程，data为空用于和FdEvent区分
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = nullptr;
+    int res = epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_tickleFd, &event);
+    TINY_ASSERT(res == 0);
 
-    //res = epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_ticklefd[0], &event);
-    //TINY_ASSERT(res == 0);
+#ifdef TINY_HAVE_IO_URING
+    if (iomanager_io_uring_enable->getValue())
+    {
+        IOUring* ring = nullptr;
+        if (IOUring::IsSupported())
+        {
+            ring = new IOUring;
+            //CQ非空时ring fd可读，data为ring本身用于和tickle、FdEvent区分
+            event.data.ptr = ring;
+            if (!ring->init(std::max(2, iomanager_io_uring_entries->getValue()))
+                || epoll_ctl(m_epollfd, EPOLL_CTL_ADD, ring->getFd(), &event))
+            {
+                delete ring;
+                ring = nullptr;
+            }
+            else
+            {
+                m_uringMaxPending = std::max(1u, ring->getCqEntries() / 2);
+            }
+        }
+        m_uring = ring;
+        TINY_LOG_INFO(logger) << "name = " << name << " io backend = " << (m_uring ? "io_uring" : "epoll");
+    }
+#endif
 
-    eventResize(32);
+    m_fdEvents = new std::atomic<FdEvent*>[FD_SEGMENT_COUNT];
+    for (size_t i = 0; i < FD_SEGMENT_COUNT; ++i)
+    {
+        m_fdEvents[i] = nullptr;
+    }
+    getFdEvent(0, true);
+    initTimerShards(getWorkerCount() + 1);
     start(); //开启多线程多协程
 }
 
@@ -39,14 +82,18 @@ IOManager::~IOManager()
 {
     stop();
     close(m_epollfd);
-    //close(m_ticklefd[0]);
-    //close(m_ticklefd[1]);
+    close(m_tickleFd);
+#ifdef TINY_HAVE_IO_URING
+    delete m_uring;
+#endif
 
-    for (size_t i = 0; i < m_fdEvents.size(); ++i)
+    for (size_t i = 0; i < FD_SEGMENT_COUNT; ++i)
     {
-        if (m_fdEvents[i])
-            delete m_fdEvents[i];
+        FdEvent* segment = m_fdEvents[i].load();
+        if (segment)
+            delete[] segment;
     }
+    delete[] m_fdEvents;
 }
 
 IOManager::FdEvent::Event& IOManager::FdEvent::getEvent(IOManager::EventType et)
@@ -62,19 +109,26 @@ IOManager::FdEvent::Event& IOManager::FdEvent::getEvent(IOManager::EventType et)
     }
 }
 
-void IOManager::FdEvent::resetEvent(Event e)
+void IOManager::FdEvent::resetEvent(Event& e)
 {
     e.scheduler = nullptr;
     e.fiber.reset();
     e.cb = nullptr;
 }
 
-void IOManager::FdEvent::triggerEvent(EventType eventtype)
+void IOManager::FdEvent::triggerEvent(EventType eventtype, Scheduler* owner, std::vector<FiberAndThread>* batch)
 {
     TINY_ASSERT(et & eventtype);
     et = (EventType)(et & ~eventtype);
     Event& event = getEvent(eventtype);
-    if (event.cb)
+    if (batch && event.scheduler == owner)
+    {
+        if (event.cb)
+            batch->push_back(FiberAndThread(&event.cb, -1));
+        else
+            batch->push_back(FiberAndThread(&event.fiber, -1));
+    }
+    else if (event.cb)
     {
         event.scheduler->schedule(&event.cb);
     }
@@ -86,36 +140,40 @@ void IOManager::FdEvent::triggerEvent(EventType eventtype)
     return;
 }
 
-void IOManager::eventResize(size_t size)
+IOManager::FdEvent* IOManager::getFdEvent(int fd, bool auto_create)
 {
-    m_fdEvents.resize(size);
-    for (size_t i = 0; i < m_fdEvents.size(); ++i)
+    if (fd < 0 || (size_t)fd >= FD_SEGMENT_SIZE * FD_SEGMENT_COUNT)
+        return nullptr;
+    std::atomic<FdEvent*>& slot = m_fdEvents[fd >> FD_SEGMENT_SHIFT];
+    FdEvent* segment = slot.load(std::memory_order_acquire);
+    if (!segment)
     {
-        if (!m_fdEvents[i])
+        if (!auto_create)
+            return nullptr;
+        FdEvent* fresh = new FdEvent[FD_SEGMENT_SIZE];
+        int base = fd & ~(FD_SEGMENT_SIZE - 1);
+        for (size_t i = 0; i < FD_SEGMENT_SIZE; ++i)
         {
-            m_fdEvents[i] = new FdEvent();
-            m_fdEvents[i]->fd = i;
+            fresh[i].fd = base + i;
         }
+        //其他线程先创建成功则使用它的分段
+        if (slot.compare_exchange_strong(segment, fresh, std::memory_order_acq_rel))
+            segment = fresh;
+        else
+            delete[] fresh;
     }
+    return &segment[fd & (FD_SEGMENT_SIZE - 1)];
 }
 
 // 0 success, -1 error
 int IOManager::addEvent(int fd, EventType et, std::function<void()> cb)
 {
     //TINY_LOG_INFO(logger) << "addEvent";
-    FdEvent* fd_event = nullptr;
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    if ((int)m_fdEvents.size() > fd)
-    {
-        fd_event = m_fdEvents[fd];
-        lock.unlock();
-    }
-    else
+    FdEvent* fd_event = getFdEvent(fd, true);
+    if (!fd_event)
     {
-        lock.unlock();
-        RWMutexType::WriteLockGuard lock2(m_mutex);
-        eventResize(fd * 1.5);
-        fd_event = m_fdEvents[fd];
+        TINY_LOG_ERROR(logger) << "addEvent fd = " << fd << " out of range";
+        return -1;
     }
     FdEvent::MutexType::MutexLockGuard lock2(fd_event->mutex);
     if (fd_event->et & et)
@@ -124,18 +182,35 @@ int IOManager::addEvent(int fd, EventType et, std::function<void()> cb)
             << " fd_event.event = " << fd_event->et;
         TINY_ASSERT(!(fd_event->et & et));
     }
-    int op = fd_event->et ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_event->et | et;
-    epevent.data.ptr = fd_event;
+    bool trigger_now = false;
+    if (!m_persistent || !fd_event->registered)
+    {
+        int op = EPOLL_CTL_ADD;
+        epoll_event epevent;
+        if (m_persistent)
+            epevent.events = EPOLLET | EPOLLIN | EPOLLOUT;
+        else
+        {
+            op = fd_event->et ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            epevent.events = EPOLLET | fd_event->et | et;
+        }
+        epevent.data.ptr = fd_event;
 
-    int res = epoll_ctl(m_epollfd, op, fd, &epevent);
-    if (res)
+        int res = epoll_ctl(m_epollfd, op, fd, &epevent);
+        if (res && !(m_persistent && errno == EEXIST))
+        {
+            TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
+                << op << ", " << fd << ", " << epevent.events << "): "
+                << res << " (" << errno << ") (" << strerror(errno) << ")";
+            return -1;
+        }
+        fd_event->registered = m_persistent;
+    }
+    else if (fd_event->ready & et)
     {
-        TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
-            << op << ", " << fd << ", " << epevent.events << "): "
-            << res << " (" << errno << ") (" << strerror(errno) << ")";
-        return -1;
+        //等待之前边沿已经到达，直接触发，由调用者重试
+        fd_event->ready &= ~et;
+        trigger_now = true;
     }
     ++m_pendingEventCount;
     fd_event->et = (EventType)(fd_event->et | et);
@@ -151,33 +226,39 @@ int IOManager::addEvent(int fd, EventType et, std::function<void()> cb)
         event.fiber = Fiber::GetThis();
         TINY_ASSERT(event.fiber->getState() == Fiber::EXEC);
     }
+    if (trigger_now)
+    {
+        fd_event->triggerEvent(et);
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 bool IOManager::delEvent(int fd, EventType et)
 {
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    if ((int)m_fdEvents.size() <= fd)
+    FdEvent* fd_event = getFdEvent(fd, false);
+    if (!fd_event)
         return false;
-    FdEvent* fd_event = m_fdEvents[fd];
-    lock.unlock();
 
     FdEvent::MutexType::MutexLockGuard lock2(fd_event->mutex);
     if (!(fd_event->et & et))
         return false;
     EventType new_event = (EventType)(fd_event->et & ~et);
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_event;
-    epevent.data.ptr = fd_event;
-
-    int res = epoll_ctl(m_epollfd, op, fd, &epevent);
-    if (res)
+    if (!m_persistent)
     {
-        TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
-            << op << ", " << fd << ", " << epevent.events << "): "
-            << res << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_event;
+        epevent.data.ptr = fd_event;
+
+        int res = epoll_ctl(m_epollfd, op, fd, &epevent);
+        if (res)
+        {
+            TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
+                << op << ", " << fd << ", " << epevent.events << "): "
+                << res << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     --m_pendingEventCount;
     fd_event->et = new_event;
@@ -188,28 +269,29 @@ bool IOManager::delEvent(int fd, EventType et)
 
 bool IOManager::cancelEvent(int fd, EventType et)
 {
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    if ((int)m_fdEvents.size() <= fd)
+    FdEvent* fd_event = getFdEvent(fd, false);
+    if (!fd_event)
         return false;
-    FdEvent* fd_event = m_fdEvents[fd];
-    lock.unlock();
 
     FdEvent::MutexType::MutexLockGuard lock2(fd_event->mutex);
     if (!(fd_event->et & et))
         return false;
     EventType new_event = (EventType)(fd_event->et & ~et);
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_event;
-    epevent.data.ptr = fd_event;
-
-    int res = epoll_ctl(m_epollfd, op, fd, &epevent);
-    if (res)
+    if (!m_persistent)
     {
-        TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
-            << op << ", " << fd << ", " << epevent.events << "): "
-            << res << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_event;
+        epevent.data.ptr = fd_event;
+
+        int res = epoll_ctl(m_epollfd, op, fd, &epevent);
+        if (res)
+        {
+            TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
+                << op << ", " << fd << ", " << epevent.events << "): "
+                << res << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     //FdEvent::Event& event = fd_event->getEvent(et);
     fd_event->triggerEvent(et);
@@ -219,14 +301,24 @@ bool IOManager::cancelEvent(int fd, EventType et)
 
 bool IOManager::cancelAll(int fd)
 {
-    RWMutexType::ReadLockGuard lock(m_mutex);
-    if ((int)m_fdEvents.size() <= fd)
+#if defined(TINY_HAVE_IO_URING) && defined(IORING_ASYNC_CANCEL_FD)
+    if (m_uring && m_uringPending > 0)
+    {
+        //取消fd上所有未完成的io_uring请求，它们以-ECANCELED完成
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.fd = fd;
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        m_uring->submit(&sqe, 1);
+    }
+#endif
+    FdEvent* fd_event = getFdEvent(fd, false);
+    if (!fd_event)
         return false;
-    FdEvent* fd_event = m_fdEvents[fd];
-    lock.unlock();
 
     FdEvent::MutexType::MutexLockGuard lock2(fd_event->mutex);
-    if (!fd_event->et)
+    if (!fd_event->et && !fd_event->registered)
         return false;
     int op = EPOLL_CTL_DEL;
     epoll_event epevent;
@@ -234,13 +326,16 @@ bool IOManager::cancelAll(int fd)
     epevent.data.ptr = fd_event;
 
     int res = epoll_ctl(m_epollfd, op, fd, &epevent);
-    if (res)
+    //常驻模式下fd可能已经被关闭，epoll中已经不存在
+    if (res && !(fd_event->registered && (errno == ENOENT || errno == EBADF)))
     {
         TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
             << op << ", " << fd << ", " << epevent.events << "): "
             << res << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
     }
+    fd_event->registered = false;
+    fd_event->ready = NONE;
 
     if (fd_event->et & READ)
     {
@@ -258,6 +353,95 @@ bool IOManager::cancelAll(int fd)
     return true;
 }
 
+#ifdef TINY_HAVE_IO_URING
+//等待io_uring完成的协程，位于发起请求的协程栈上
+struct UringWaiter
+{
+    Ref<Fiber> fiber;
+    int res = 0;
+    //请求方和收割方各置一次，后到的一方负责继续:
+    //收割方后到说明协程已经挂起，由它调度；请求方后到说明已经完成，不再挂起
+    std::atomic<bool> done = {false};
+};
+#endif
+
+int IOManager::submitIO(io_uring_sqe& sqe, uint64_t timeout_ms)
+{
+#ifdef TINY_HAVE_IO_URING
+    if (!m_uring)
+        return -EAGAIN;
+    UringWaiter waiter;
+    waiter.fiber = Fiber::GetThis();
+    io_uring_sqe sqes[2];
+    unsigned count = 1;
+    sqes[0] = sqe;
+    sqes[0].user_data = (uint64_t)(uintptr_t)&waiter;
+    __kernel_timespec ts;
+    if (timeout_ms != ~0ull)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = timeout_ms % 1000 * 1000000;
+        sqes[0].flags |= IOSQE_IO_LINK;
+        memset(&sqes[1], 0, sizeof(sqes[1]));
+        sqes[1].opcode = IORING_OP_LINK_TIMEOUT;
+        sqes[1].fd = -1;
+        sqes[1].addr = (uint64_t)(uintptr_t)&ts;
+        sqes[1].len = 1;
+        count = 2;
+    }
+    //在途请求太多时交给epoll，避免CQ溢出
+    if (++m_uringPending > m_uringMaxPending)
+    {
+        --m_uringPending;
+        return -EAGAIN;
+    }
+    if (!m_uring->submit(sqes, count))
+    {
+        --m_uringPending;
+        return -EAGAIN;
+    }
+    //数据已经就绪的请求在io_uring_enter中就完成了，这里直接收割
+    reapUring(nullptr);
+    if (!waiter.done.exchange(true))
+    {
+        Fiber::YieldToHold();
+    }
+    return waiter.res;
+#else
+    return -EAGAIN;
+#endif
+}
+
+void IOManager::reapUring(std::vector<FiberAndThread>* batch)
+{
+#ifdef TINY_HAVE_IO_URING
+    if (!m_uring)
+        return;
+    static const size_t MAX_CQES = 64;
+    io_uring_cqe cqes[MAX_CQES];
+    size_t n = 0;
+    while ((n = m_uring->reap(cqes, MAX_CQES)) > 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            //LINK_TIMEOUT和取消请求的user_data为0
+            UringWaiter* waiter = (UringWaiter*)(uintptr_t)cqes[i].user_data;
+            if (!waiter)
+                continue;
+            waiter->res = cqes[i].res;
+            --m_uringPending;
+            //请求方还没有挂起，交给它自己继续，之后不能再访问waiter
+            if (!waiter->done.exchange(true))
+                continue;
+            if (batch)
+                batch->push_back(FiberAndThread(&waiter->fiber, -1));
+            else
+                schedule(&waiter->fiber);
+        }
+    }
+#endif
+}
+
 IOManager* IOManager::GetThis()
 {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
@@ -265,11 +449,11 @@ IOManager* IOManager::GetThis()
 
 void IOManager::tickle()
 {
-    if (hasIdleThreads())
+    //没有线程在epoll_wait中，不需要唤醒；上一次唤醒还没有被处理时也不重复写
+    if (!hasIdleThreads() || m_tickled.exchange(true))
         return;
-    //TINY_LOG_INFO(logger) << "tick";
-    //int res = ::write(m_ticklefd[1], "T", 1);
-    //TINY_ASSERT(res == 1);
+    int res = eventfd_write(m_tickleFd, 1);
+    TINY_ASSERT(res == 0);
 }
 
 bool IOManager::stopping()
@@ -281,17 +465,20 @@ bool IOManager::stopping()
 bool IOManager::stopping(uint64_t& time_out)
 {
     time_out = getNextTimer();
-    return time_out == ~0ull
+    return !hasTimer()
         && m_pendingEventCount == 0
+        && m_uringPending == 0
         && Scheduler::stopping();
 }
 
 void IOManager::idle()
 {
-    epoll_event* epevents = new epoll_event[64];
+    epoll_event* epevents = new epoll_event[m_batchSize];
     std::shared_ptr<epoll_event> shared_events(epevents, [](epoll_event* ptr){
         delete[] ptr;
     });
+    //本轮到期的定时器和触发的事件，最后一次性投递
+    std::vector<FiberAndThread> batch;
 
     while (true)
     {
@@ -299,6 +486,8 @@ void IOManager::idle()
         if (stopping(next_timeout))
         {
             TINY_LOG_INFO(logger) << "name = " << getName() << " idle stopping exit";
+            //唤醒下一个idle线程，让它也退出
+            tickle();
             break;
         }
         int res = 0;
@@ -309,7 +498,14 @@ void IOManager::idle()
                 next_timeout = (int)next_timeout < MAX_TIMEOUT ? next_timeout : MAX_TIMEOUT;
             else
                 next_timeout = MAX_TIMEOUT;
-            res = epoll_wait(m_epollfd, epevents, 64, next_timeout);
+            //进入idle之后才投递的任务可能没有tickle到本线程
+            if (hasRunnableTask())
+                next_timeout = 0;
+#ifdef TINY_HAVE_IO_URING
+            if (m_uring && m_uring->hasCompletion())
+                next_timeout = 0;
+#endif
+            res = epoll_wait(m_epollfd, epevents, m_batchSize, next_timeout);
             //TINY_LOG_INFO(logger) << next_timeout;
             //TINY_LOG_INFO(logger) << "epoll_wait res = " << res;
 
@@ -326,25 +522,28 @@ void IOManager::idle()
         //------定时器任务------
         std::vector<std::function<void()>> cbs;
         listExpireCB(cbs);
-        if (!cbs.empty())
+        for (auto& cb : cbs)
         {
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
+            batch.push_back(FiberAndThread(&cb, -1));
         }
+        cbs.clear();
         //---------------------
         
         for (int i = 0; i < res; ++i)
         {
             epoll_event& epevent = epevents[i];
-            // if (epevents->data.fd == m_ticklefd[0])
-            // {
-            //     uint8_t dummy;
-            //     while (read(m_ticklefd[0], &dummy, 1) == 1)
-            //     {
-            //         //TINY_LOG_INFO(logger) << "T";
-            //     }
-            //     continue;
-            // }
+            if (!epevent.data.ptr)
+            {
+                eventfd_t dummy;
+                m_tickled = false;
+                eventfd_read(m_tickleFd, &dummy);
+                continue;
+            }
+            if (epevent.data.ptr == (void*)m_uring)
+            {
+                //完成事件统一在下面reapUring中处理
+                continue;
+            }
             FdEvent* fd_event = (FdEvent*)epevent.data.ptr;
             FdEvent::MutexType::MutexLockGuard lock(fd_event->mutex);
             if (epevent.events & (EPOLLERR | EPOLLHUP))
@@ -360,34 +559,46 @@ void IOManager::idle()
             {
                 real_event_type |= WRITE;
             }
-            if ((real_event_type & fd_event->et) == NONE)
+            if (m_persistent)
+            {
+                //没有等待者的边沿先记下，addEvent时直接触发
+                fd_event->ready |= real_event_type & ~fd_event->et;
+            }
+            //ERR/HUP时两个方向都会置位，只触发已注册的
+            real_event_type &= fd_event->et;
+            if (real_event_type == NONE)
             {
                 continue;
             }
             
-            int left_type = (fd_event->et & ~real_event_type);
-            int op = left_type ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            epevent.events = (EPOLLET | left_type);
-
-            int res2 = epoll_ctl(m_epollfd, op, fd_event->fd, &epevent);
-            if (res2)
+            if (!m_persistent)
             {
-                TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
-                    << op << ", " << fd_event->fd << ", " << epevent.events << "): "
-                    << res2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
+                int left_type = (fd_event->et & ~real_event_type);
+                int op = left_type ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                epevent.events = (EPOLLET | left_type);
+
+                int res2 = epoll_ctl(m_epollfd, op, fd_event->fd, &epevent);
+                if (res2)
+                {
+                    TINY_LOG_ERROR(logger) << "epoll_ctl(" << m_epollfd <<", "
+                        << op << ", " << fd_event->fd << ", " << epevent.events << "): "
+                        << res2 << " (" << errno << ") (" << strerror(errno) << ")";
+                    continue;
+                }
             }
             if (real_event_type & READ)
             {
-                fd_event->triggerEvent(READ);
+                fd_event->triggerEvent(READ, this, &batch);
                 --m_pendingEventCount;
             }
             if (real_event_type & WRITE)
             {
-                fd_event->triggerEvent(WRITE);
+                fd_event->triggerEvent(WRITE, this, &batch);
                 --m_pendingEventCount;
             }
         }
+        reapUring(&batch);
+        scheduleBatch(batch);
         Ref<Fiber> cur = Fiber::GetThis();
         Fiber* raw_ptr = cur.get();
         cur.reset();
@@ -400,6 +611,12 @@ void IOManager::onTimerInsertAtFront()
     tickle();
 }
 
+size_t IOManager::getTimerShard()
+{
+    int index = getWorkerIndex();
+    return index >= 0 ? index + 1 : 0;
+}
+
 
 
 }
\ No newline at end of file
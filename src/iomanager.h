@@ -1,12 +1,16 @@
 #pragma once
 #include "scheduler.h"
 #include "timer.h"
+
+struct io_uring_sqe;
+
 namespace TinyServer
 {
+class IOUring;
+
 class IOManager : public Scheduler, public TimerManager 
 {
 public:
-    typedef RWLock RWMutexType;
     enum EventType
     {
         NONE = 0x00, 
@@ -26,12 +30,15 @@ private:
         };
 
         Event& getEvent(EventType et);
-        void resetEvent(Event e);
-        void triggerEvent(EventType eventtype);
+        void resetEvent(Event& e);
+        //batch不为空时，属于owner的任务先放入batch，由调用者一次性投递
+        void triggerEvent(EventType eventtype, Scheduler* owner = nullptr, std::vector<FiberAndThread>* batch = nullptr);
         Event read;                 //读事件
         Event write;                //写事件
         int fd = 0;                 //事件关联的句柄
         EventType et = NONE;        //已注册的事件类型
+        int ready = NONE;           //常驻模式: 就绪但还没有等待者的事件
+        bool registered = false;    //常驻模式: 已经加入epoll
         MutexType mutex;
     };
 
@@ -46,6 +53,13 @@ public:
     bool cancelEvent(int fd, EventType et);
     bool cancelAll(int fd);
 
+    //iomanager.io_uring.enable打开并且内核支持时为true，否则只使用epoll
+    bool hasUring() const { return m_uring != nullptr; }
+    //在io_uring上提交sqe并挂起当前协程直到完成，返回cqe的res(失败为-errno)
+    //timeout_ms不为~0ull时链接一个LINK_TIMEOUT，超时的请求返回-ECANCELED
+    //提交失败返回-EAGAIN，调用者应该回退到epoll
+    int submitIO(io_uring_sqe& sqe, uint64_t timeout_ms);
+
     static IOManager* GetThis();
 
 protected:
@@ -55,15 +69,33 @@ protected:
     void idle() override;
 
     void onTimerInsertAtFront() override;
+    //工作线程使用自己的时间轮，外部线程使用0号
+    size_t getTimerShard() override;
 
-    void eventResize(size_t size);
+    //返回fd对应的FdEvent，所在分段不存在时按auto_create创建，fd超出范围返回nullptr
+    FdEvent* getFdEvent(int fd, bool auto_create);
+    //取出所有已完成的io_uring请求，唤醒对应协程，batch不为空时属于本IOManager的先放入batch
+    void reapUring(std::vector<FiberAndThread>* batch);
 
 private:
+    //常驻模式: fd首次addEvent时以EPOLLIN|EPOLLOUT|EPOLLET加入epoll，直到cancelAll(close)才移除
+    //事件触发和等待都不再调用epoll_ctl，没有等待者的边沿记录在FdEvent::ready中
+    bool m_persistent;
+    int m_batchSize;                        //每次epoll_wait最多返回的事件数
     int m_epollfd;
-    int m_ticklefd[2];  //用于唤醒epoll_wait(tick)
+    int m_tickleFd;                         //eventfd, 用于唤醒epoll_wait(tickle)
+    std::atomic<bool> m_tickled = {false};  //已经写入eventfd还没有被idle线程读取
     std::atomic<size_t> m_pendingEventCount = {0};
-    RWMutexType m_mutex;
-    std::vector<FdEvent*> m_fdEvents;
+    //所有线程共享的ring，ring fd同样注册在epoll中，完成事件通过epoll_wait唤醒idle
+    IOUring* m_uring = nullptr;
+    std::atomic<size_t> m_uringPending = {0};   //已提交还没有完成的io_uring请求
+    size_t m_uringMaxPending = 0;               //在途请求上限(CQ大小的一半，带超时的请求有两个cqe)
+    //两级表: 每段FD_SEGMENT_SIZE个FdEvent，段按需CAS创建，创建后直到析构都不会移动或释放
+    //查找不需要加锁，FdEvent指针在IOManager生命周期内一直有效
+    static const size_t FD_SEGMENT_SHIFT = 10;
+    static const size_t FD_SEGMENT_SIZE = 1 << FD_SEGMENT_SHIFT;
+    static const size_t FD_SEGMENT_COUNT = 4096;
+    std::atomic<FdEvent*>* m_fdEvents;
 };
 
 }
\ No newline at end of file
@@ -3,6 +3,12 @@
 #include <iostream>
 #include <ctime>
 #include "config.h"
+#include "macro.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <set>
 
 namespace TinyServer
 {
@@ -81,22 +87,200 @@ void Logger::fatal(Ref<LogEvent>& event)
     log(LogLevel::FATAL, event);
 }
 
+static thread_local bool t_pool_destroyed = false;
+
+//每个线程缓存少量LogStream和格式化缓冲，写日志的过程中又写日志时会同时用到多个
+struct LogBufferPool
+{
+    static const size_t MAX_CACHED = 8;
+    std::vector<LogStream*> streams;
+    std::vector<std::string*> buffers;
+
+    ~LogBufferPool()
+    {
+        for (auto& i : streams)
+            delete i;
+        for (auto& i : buffers)
+            delete i;
+        t_pool_destroyed = true;
+    }
+};
+
+//线程退出析构thread_local之后仍可能写日志，此时不再使用池
+static LogBufferPool* GetBufferPool()
+{
+    if (TINY_UNLICKLY(t_pool_destroyed))
+        return nullptr;
+    static thread_local LogBufferPool s_pool;
+    return &s_pool;
+}
+
+//偶尔出现的超长日志不让缓冲一直占着内存
+static const size_t s_max_cached_capacity = 64 * 1024;
+
+LogStreamBuf::LogStreamBuf()
+    : m_buf(256, '\0')
+{
+    clear();
+}
+
+void LogStreamBuf::reserve(size_t n)
+{
+    size_t capacity = epptr() - pbase();
+    if (n <= capacity)
+        return;
+    size_t used = size();
+    m_buf.resize(std::max(n, capacity * 2));
+    setp(&m_buf[0], &m_buf[0] + m_buf.size());
+    pbump(used);
+}
+
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type ch)
+{
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+    reserve(size() + 1);
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n)
+{
+    reserve(size() + n);
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+}
+
+LogStream::LogStream()
+    : std::ostream(nullptr)
+{
+    rdbuf(&m_buf);
+}
+
+void LogStream::reset()
+{
+    m_buf.clear();
+    std::ostream::clear();
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    width(0);
+    precision(6);
+    fill(' ');
+}
+
+LogStream* LogStream::Acquire()
+{
+    LogBufferPool* pool = GetBufferPool();
+    if (!pool || pool->streams.empty())
+        return new LogStream;
+    LogStream* stream = pool->streams.back();
+    pool->streams.pop_back();
+    return stream;
+}
+
+void LogStream::Release(LogStream* stream)
+{
+    LogBufferPool* pool = GetBufferPool();
+    if (!pool || pool->streams.size() >= LogBufferPool::MAX_CACHED 
+        || stream->m_buf.capacity() > s_max_cached_capacity)
+    {
+        delete stream;
+        return;
+    }
+    stream->reset();
+    pool->streams.push_back(stream);
+}
+
+//格式化输出用的缓冲，作用域结束时还回池中
+class FormatBuffer
+{
+public:
+    FormatBuffer()
+    {
+        LogBufferPool* pool = GetBufferPool();
+        if (!pool || pool->buffers.empty())
+        {
+            m_buf = new std::string;
+            m_buf->reserve(256);
+        }
+        else
+        {
+            m_buf = pool->buffers.back();
+            pool->buffers.pop_back();
+        }
+    }
+
+    ~FormatBuffer()
+    {
+        LogBufferPool* pool = GetBufferPool();
+        if (!pool || pool->buffers.size() >= LogBufferPool::MAX_CACHED 
+            || m_buf->capacity() > s_max_cached_capacity)
+        {
+            delete m_buf;
+            return;
+        }
+        m_buf->clear();
+        pool->buffers.push_back(m_buf);
+    }
+
+    std::string& str() { return *m_buf; }
+
+private:
+    std::string* m_buf;
+};
+
+void LogEvent::format(const char* fmt, va_list al)
+{
+    char buf[512];
+    va_list copy;
+    va_copy(copy, al);
+    int len = vsnprintf(buf, sizeof(buf), fmt, copy);
+    va_end(copy);
+    if (len < 0)
+        return;
+    if ((size_t)len < sizeof(buf))
+    {
+        m_ss->write(buf, len);
+        return;
+    }
+    std::string str(len + 1, '\0');
+    vsnprintf(&str[0], str.size(), fmt, al);
+    m_ss->write(str.data(), len);
+}
+
 LogEventWarp::LogEventWarp(const Ref<LogEvent>& event)
     : m_event(event) {}
 
+LogEventWarp::LogEventWarp(const Ref<Logger>& logger, LogLevel::Level level, 
+    const char* file, uint32_t line, uint32_t elapse, 
+    uint32_t time, uint32_t threadId, const std::string& threadName, uint32_t fiberId)
+    : m_inline(true)
+{
+    LogEvent* event = new (&m_storage) LogEvent(logger, level, file, line, 
+        elapse, time, threadId, threadName, fiberId);
+    m_event = Ref<LogEvent>(Ref<LogEvent>(), event);
+}
+
 LogEventWarp::~LogEventWarp()
 {
     m_event->getLogger()->log(m_event->getLevel(), m_event);
+    if (m_inline)
+    {
+        LogEvent* event = m_event.get();
+        m_event.reset();
+        event->~LogEvent();
+    }
 }
 
-std::stringstream& LogEventWarp::getSS()
+std::ostream& LogEventWarp::getSS()
 {
     return m_event->getSS();
 }
 
 void Logger::log(LogLevel::Level level, Ref<LogEvent>& event)
 {
-    if (m_level <= level)
+    if (getLevel() <= level)
     {
         if (!m_appenders.empty())
         {
@@ -148,7 +332,7 @@ std::string Logger::toYamlString()
     MutexType::MutexLockGuard lock(m_mutex);
     YAML::Node node;
     node["name"] = m_name;
-    node["level"] = LogLevel::ToString(m_level);
+    node["level"] = LogLevel::ToString(getLevel());
     if (m_formatter)
         node["formatter"] = m_formatter->getPattern();
     for (auto& item : m_appenders)
@@ -164,8 +348,11 @@ void ConsoleLog::log(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>&
 {
     if (m_level <= level)
     {
+        FormatBuffer buf;
         MutexType::MutexLockGuard lock(m_mutex); 
-        std::cout << m_formatter->format(level, logger, event);
+        m_formatter->format(buf.str(), level, logger, event);
+        std::cout.write(buf.str().data(), buf.str().size());
+        std::cout.flush();
     }
 }
 
@@ -198,7 +385,7 @@ bool FileLog::reopen()
     {
         m_fileStream.close();
     }
-    m_fileStream.open(m_fileName);
+    m_fileStream.open(m_fileName, std::ios::app);
     return !!m_fileStream;
 }
 
@@ -212,8 +399,11 @@ void FileLog::log(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& eve
             reopen();
             m_lastTime = now;
         }
+        FormatBuffer buf;
         MutexType::MutexLockGuard lock(m_mutex); 
-        m_fileStream << m_formatter->format(level, logger, event);
+        m_formatter->format(buf.str(), level, logger, event);
+        m_fileStream.write(buf.str().data(), buf.str().size());
+        m_fileStream.flush();
     }
 }
 
@@ -234,178 +424,377 @@ std::string FileLog::toYamlString()
     return ss.str();
 }
 
-LogFormatter::LogFormatter(const std::string& pattern)
-    : m_pattern(pattern)
+//fork之后子进程递增，AsyncFileLog据此发现刷盘线程已经不存在
+static std::atomic<int> s_fork_generation = {0};
+
+//存活的AsyncFileLog，不释放，避免进程退出时晚于它析构的日志器访问已析构的集合
+struct AsyncLogRegistry
 {
-    init();
+    MutexLock mutex;
+    std::set<AsyncFileLog*> logs;
+};
+
+static AsyncLogRegistry& GetAsyncLogs()
+{
+    static AsyncLogRegistry* s_registry = new AsyncLogRegistry;
+    return *s_registry;
 }
 
-std::string LogFormatter::format(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event)
+void AsyncFileLog::PrepareFork()
 {
-    std::stringstream ss;
-    for (auto& item : m_items)
+    AsyncLogRegistry& registry = GetAsyncLogs();
+    registry.mutex.lock();
+    for (auto log : registry.logs)
     {
-        item->format(ss, level, logger, event);
+        log->m_mutex.lock();
+        log->m_bufMutex.lock();
     }
-    return ss.str();
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem
+void AsyncFileLog::ParentAfterFork()
 {
-public:
-    MessageFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    AsyncLogRegistry& registry = GetAsyncLogs();
+    for (auto log : registry.logs)
     {
-        os << event->getContent();
+        log->m_bufMutex.unlock();
+        log->m_mutex.unlock();
     }
-};
+    registry.mutex.unlock();
+}
 
-class LevelFormatItem : public LogFormatter::FormatItem
+void AsyncFileLog::ChildAfterFork()
 {
-public:
-    LevelFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    ++s_fork_generation;
+    AsyncLogRegistry& registry = GetAsyncLogs();
+    for (auto log : registry.logs)
     {
-        os << LogLevel::ToString(level);
+        log->m_cond.reinitAfterFork();
+        log->m_freeCond.reinitAfterFork();
+        log->m_bufMutex.unlock();
+        log->m_mutex.unlock();
     }
-};
+    registry.mutex.unlock();
+}
 
-class ElapseFormatItem : public LogFormatter::FormatItem
+struct ForkIniter
 {
-public:
-    ElapseFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    ForkIniter()
     {
-        os << event->getElapse();
+        pthread_atfork(&AsyncFileLog::PrepareFork, &AsyncFileLog::ParentAfterFork, 
+            &AsyncFileLog::ChildAfterFork);
     }
 };
 
-class LoggerNameFormatItem : public LogFormatter::FormatItem
+static ForkIniter s_fork_initer;
+
+AsyncFileLog::AsyncFileLog(const std::string& fileName, uint32_t flushInterval, 
+    uint32_t bufferSize, Overflow overflow)
+    : m_fileName(fileName), m_flushInterval(std::max(1u, flushInterval))
+    , m_bufferSize(std::max(4096u, bufferSize)), m_overflow(overflow)
+    , m_cond(m_bufMutex), m_freeCond(m_bufMutex), m_forkGeneration(s_fork_generation)
 {
-public:
-    LoggerNameFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
-    {
-        os << event->getLogger()->getName();
-    }
-};
+    m_front.reserve(m_bufferSize);
+    m_back.reserve(m_bufferSize);
+    openFile();
+    m_thread = new Thread(std::bind(&AsyncFileLog::run, this), "log_flush");
+    AsyncLogRegistry& registry = GetAsyncLogs();
+    MutexLock::MutexLockGuard lock(registry.mutex);
+    registry.logs.insert(this);
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem
+AsyncFileLog::~AsyncFileLog()
 {
-public:
-    ThreadIdFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
     {
-        os << event->getThreadId();
+        AsyncLogRegistry& registry = GetAsyncLogs();
+        MutexLock::MutexLockGuard lock(registry.mutex);
+        registry.logs.erase(this);
     }
-};
+    {
+        MutexType::MutexLockGuard lock(m_bufMutex);
+        m_stop = true;
+        m_cond.notify();
+    }
+    //子进程中父进程的刷盘线程已经不存在，不能join
+    if (m_forkGeneration == s_fork_generation)
+    {
+        m_thread->join();
+        delete m_thread;
+    }
+    if (m_fd >= 0)
+        close(m_fd);
+}
 
-class ThreadNameFormatItem : public LogFormatter::FormatItem
+bool AsyncFileLog::openFile()
 {
-public:
-    ThreadNameFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    int fd = open(m_fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
     {
-        os << event->getThreadName();
+        std::cout << "AsyncFileLog open " << m_fileName << " errno = " << errno 
+            << " errstr = " << strerror(errno) << std::endl;
+        return false;
     }
-};
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = fd;
+    return true;
+}
 
-class FiberIdFormatItem : public LogFormatter::FormatItem
+void AsyncFileLog::restartAfterFork()
 {
-public:
-    FiberIdFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    //父进程的线程对象在子进程中不可用，直接丢弃；未落盘的数据由父进程负责
+    m_thread = nullptr;
+    m_front.clear();
+    m_back.clear();
+    m_backFull = false;
+    m_appended = m_written = 0;
+    m_forkGeneration = s_fork_generation;
+    m_thread = new Thread(std::bind(&AsyncFileLog::run, this), "log_flush");
+}
+
+void AsyncFileLog::log(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event)
+{
+    if (m_level > level)
+        return;
+    //格式化在锁外进行，临界区只有一次内存拷贝
+    FormatBuffer buf;
+    getFomatter()->format(buf.str(), level, logger, event);
+    const std::string& msg = buf.str();
+    MutexType::MutexLockGuard lock(m_bufMutex);
+    if (TINY_UNLICKLY(m_forkGeneration != s_fork_generation))
     {
-        os << event->getcFiberId();
+        restartAfterFork();
     }
-};
+    while (!m_front.empty() && m_front.size() + msg.size() > m_bufferSize)
+    {
+        if (!m_backFull)
+        {
+            m_front.swap(m_back);
+            m_backFull = true;
+            m_cond.notify();
+            break;
+        }
+        if (m_overflow == DROP || m_stop)
+        {
+            ++m_dropped;
+            return;
+        }
+        m_freeCond.wait();
+    }
+    m_front.append(msg);
+    m_appended += msg.size();
+}
 
-class DataTimeFormatItem : public LogFormatter::FormatItem
+void AsyncFileLog::reopen()
 {
-public:
-    DataTimeFormatItem(const std::string& fmt = "%Y-%m-%d %H:%M:%S")
-        : m_format(fmt) 
+    MutexType::MutexLockGuard lock(m_bufMutex);
+    m_reopen = true;
+    m_cond.notify();
+}
+
+void AsyncFileLog::flush()
+{
+    MutexType::MutexLockGuard lock(m_bufMutex);
+    if (TINY_UNLICKLY(m_forkGeneration != s_fork_generation))
     {
-        if (m_format.empty())
-            m_format = "%Y-%m-%d %H:%M:%S";
+        restartAfterFork();
     }
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    uint64_t target = m_appended;
+    while (m_written < target && !m_stop)
     {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        m_flushRequest = true;
+        m_cond.notify();
+        m_freeCond.wait();
     }
-private:
-    std::string m_format;
-};
+}
 
-class FileNameFormatItem : public LogFormatter::FormatItem
+void AsyncFileLog::run()
 {
-public:
-    FileNameFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    std::string writing;
+    writing.reserve(m_bufferSize);
+    while (true)
     {
-        os << event->getFile();
+        bool reopen = false;
+        bool stop = false;
+        {
+            MutexType::MutexLockGuard lock(m_bufMutex);
+            if (!m_backFull && !m_stop && !m_flushRequest && !m_reopen)
+            {
+                m_cond.waitFor(m_flushInterval);
+            }
+            //到了刷盘间隔或者被要求刷盘，前台缓冲里的数据也一起写
+            if (!m_backFull && !m_front.empty())
+            {
+                m_front.swap(m_back);
+                m_backFull = true;
+            }
+            if (m_backFull)
+            {
+                writing.swap(m_back);
+                m_backFull = false;
+                m_freeCond.notifyAll();
+            }
+            m_flushRequest = false;
+            reopen = m_reopen;
+            m_reopen = false;
+            stop = m_stop;
+        }
+        if (reopen)
+        {
+            openFile();
+        }
+        if (writing.empty())
+        {
+            if (stop)
+                break;
+            continue;
+        }
+        const char* data = writing.data();
+        size_t left = writing.size();
+        while (left > 0 && m_fd >= 0)
+        {
+            ssize_t n = write(m_fd, data, left);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::cout << "AsyncFileLog write " << m_fileName << " errno = " << errno 
+                    << " errstr = " << strerror(errno) << std::endl;
+                break;
+            }
+            data += n;
+            left -= n;
+        }
+        MutexType::MutexLockGuard lock(m_bufMutex);
+        m_written += writing.size();
+        writing.clear();
+        m_freeCond.notifyAll();
     }
-};
+}
 
-class LineFormatItem : public LogFormatter::FormatItem
+std::string AsyncFileLog::toYamlString()
 {
-public:
-    LineFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    MutexType::MutexLockGuard lock(m_mutex); 
+    YAML::Node node;
+    node["type"] = "AsyncFileLog";
+    node["file"] = m_fileName;
+    node["flush_interval"] = m_flushInterval;
+    node["buffer_size"] = m_bufferSize;
+    node["overflow"] = m_overflow == DROP ? "drop" : "block";
+    if (m_level != LogLevel::UNKNOW)
+        node["level"] = LogLevel::ToString(m_level);
+    if (m_hasFormatter && m_formatter)
     {
-        os << event->getLine();
+        node["fomatter"] = m_formatter->getPattern();
     }
-};
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
 
-class NewLineFormatItem : public LogFormatter::FormatItem
+static std::atomic<uint64_t> s_formatter_id = {0};
+
+LogFormatter::LogFormatter(const std::string& pattern)
+    : m_pattern(pattern), m_id(++s_formatter_id)
 {
-public:
-    NewLineFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    init();
+}
+
+std::string LogFormatter::format(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event)
+{
+    std::string str;
+    format(str, level, logger, event);
+    return str;
+}
+
+static void AppendUInt(std::string& out, uint64_t value)
+{
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    do
     {
-        os << std::endl;
-    }
-};
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out.append(p, end - p);
+}
 
-class StringFormatItem : public LogFormatter::FormatItem
+void LogFormatter::format(std::string& out, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event)
 {
-public:
-    StringFormatItem(const std::string& str)
-        : m_string(str) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    for (size_t i = 0; i < m_ops.size(); ++i)
     {
-        os << m_string;
+        const Op& op = m_ops[i];
+        switch (op.type)
+        {
+        case Op::STRING:
+            out.append(op.arg);
+            break;
+        case Op::MESSAGE:
+            out.append(event->getContentData(), event->getContentSize());
+            break;
+        case Op::LEVEL:
+            out.append(LogLevel::ToString(level));
+            break;
+        case Op::ELAPSE:
+            AppendUInt(out, event->getElapse());
+            break;
+        case Op::LOGGER_NAME:
+            out.append(event->getLogger()->getName());
+            break;
+        case Op::THREAD_ID:
+            AppendUInt(out, event->getThreadId());
+            break;
+        case Op::NEWLINE:
+            out.push_back('\n');
+            break;
+        case Op::DATETIME:
+            formatTime(out, i, event->getTime());
+            break;
+        case Op::FILENAME:
+            out.append(event->getFile());
+            break;
+        case Op::LINE:
+            AppendUInt(out, event->getLine());
+            break;
+        case Op::TAB:
+            out.push_back('\t');
+            break;
+        case Op::FIBER_ID:
+            AppendUInt(out, event->getcFiberId());
+            break;
+        case Op::THREAD_NAME:
+            out.append(event->getThreadName());
+            break;
+        }
     }
+}
 
-private:
-    std::string m_string;
+//按(formatter, 指令位置)直接映射的线程局部缓存，同一秒内只做一次localtime_r和strftime
+struct TimeCache
+{
+    uint64_t id;
+    size_t index;
+    time_t time;
+    size_t len;
+    char buf[64];
 };
 
-class TabFormatItem : public LogFormatter::FormatItem
+static thread_local TimeCache t_time_cache[4];
+
+void LogFormatter::formatTime(std::string& out, size_t index, time_t time)
 {
-public:
-    TabFormatItem(const std::string& fmt)
-        : FormatItem(fmt) {}
-    void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    TimeCache& cache = t_time_cache[(m_id + index) & 3];
+    if (cache.id != m_id || cache.index != index || cache.time != time)
     {
-        os << '\t';
+        struct tm tm;
+        localtime_r(&time, &tm);
+        cache.len = strftime(cache.buf, sizeof(cache.buf), m_ops[index].arg.c_str(), &tm);
+        cache.id = m_id;
+        cache.index = index;
+        cache.time = time;
     }
-};
+    out.append(cache.buf, cache.len);
+}
 
 //%d [%p] %f:%l %m
 void LogFormatter::init() 
@@ -498,22 +887,22 @@ void LogFormatter::init()
     {
         vec.push_back(std::make_tuple(nstr, "", 0));
     }
-    static std::map<std::string, std::function<Ref<FormatItem>(const std::string& str)> > s_format_items = {
-#define XX(str, C) \
-        {#str, [](const std::string& fmt) { return Ref<FormatItem>(new C(fmt));}}
-
-        XX(m, MessageFormatItem),
-        XX(p, LevelFormatItem),
-        XX(r, ElapseFormatItem),
-        XX(c, LoggerNameFormatItem),
-        XX(t, ThreadIdFormatItem),
-        XX(n, NewLineFormatItem),
-        XX(d, DataTimeFormatItem),
-        XX(f, FileNameFormatItem),
-        XX(l, LineFormatItem),
-        XX(T, TabFormatItem),
-        XX(F, FiberIdFormatItem),
-        XX(N, ThreadNameFormatItem),
+    static std::map<std::string, Op::Type> s_op_types = {
+#define XX(str, type) \
+        {#str, Op::type}
+
+        XX(m, MESSAGE),
+        XX(p, LEVEL),
+        XX(r, ELAPSE),
+        XX(c, LOGGER_NAME),
+        XX(t, THREAD_ID),
+        XX(n, NEWLINE),
+        XX(d, DATETIME),
+        XX(f, FILENAME),
+        XX(l, LINE),
+        XX(T, TAB),
+        XX(F, FIBER_ID),
+        XX(N, THREAD_NAME),
 #undef XX
     };
 
@@ -521,22 +910,23 @@ void LogFormatter::init()
     {
         if(std::get<2>(i) == 0) 
         {
-            m_items.push_back(Ref<FormatItem>(new StringFormatItem(std::get<0>(i))));
+            m_ops.push_back(Op{Op::STRING, std::get<0>(i)});
         } 
         else 
         {
-            auto it = s_format_items.find(std::get<0>(i));  //找到符合的FormatClass
-            if(it == s_format_items.end()) 
+            auto it = s_op_types.find(std::get<0>(i));
+            if(it == s_op_types.end()) 
             {
-                m_items.push_back(Ref<FormatItem>(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+                m_ops.push_back(Op{Op::STRING, "<<error_format %" + std::get<0>(i) + ">>"});
                 m_error = true;
             } 
             else 
             {
-                m_items.push_back(it->second(std::get<1>(i)));
+                m_ops.push_back(Op{it->second, std::get<1>(i)});
+                if (it->second == Op::DATETIME && m_ops.back().arg.empty())
+                    m_ops.back().arg = "%Y-%m-%d %H:%M:%S";
             }
         }
-        //std::cout << "{" << std::get<0>(i) << "} - {" << std::get<1>(i) << "} - }" << std::get<2>(i) << "}" << std::endl;
     }
 }
 
@@ -590,6 +980,11 @@ struct LogIniter
                     {
                         appender.reset(new ConsoleLog());
                     }
+                    else if (ap.type == 3)
+                    {
+                        appender.reset(new AsyncFileLog(ap.file, ap.flush_interval, ap.buffer_size, 
+                            ap.overflow == "drop" ? AsyncFileLog::DROP : AsyncFileLog::BLOCK));
+                    }
                     appender->setLevel(ap.level);
                     if (!ap.formatter.empty())
                     {
@@ -8,6 +8,8 @@
 #include <iostream>
 #include <map>
 #include <stdarg.h>
+#include <type_traits>
+#include <atomic>
 #include "util.h"
 #include "Singleton.h"
 #include "thread.h"
@@ -15,10 +17,20 @@
 template<typename T>
 using Ref = std::shared_ptr<T>;
 
+//编译期保留的最低日志级别(LogLevel::Level的数值)，低于它的日志语句整个被编译掉，流式参数也不会求值
+//由cmake选项TINY_LOG_STRIP_DEBUG_INFO设置为3(WARN)，默认1(DEBUG)全部保留
+#ifndef TINY_LOG_ACTIVE_LEVEL
+#define TINY_LOG_ACTIVE_LEVEL 1
+#endif
+
+//级别未开启时只有一次relaxed的原子读，不会构造LogEvent
+#define TINY_LOG_ENABLED(logger, level)\
+    ((level) >= TINY_LOG_ACTIVE_LEVEL && (logger)->getLevel() <= (level))
+
 #define TINY_LOG_LEVEL(logger, level)\
-    if (logger->getLevel() <= level)\
-    TinyServer::LogEventWarp(Ref<TinyServer::LogEvent>(new TinyServer::LogEvent(logger, level, __FILE__, __LINE__,\
-    0, time(0), TinyServer::GetThreadId(), TinyServer::Thread::GetName(), TinyServer::GetFiberId()))).getSS()
+    if (TINY_LOG_ENABLED(logger, level))\
+    TinyServer::LogEventWarp(logger, level, __FILE__, __LINE__,\
+    0, time(0), TinyServer::GetThreadId(), TinyServer::Thread::GetName(), TinyServer::GetFiberId()).getSS()
 
 #define TINY_LOG_DEBUG(logger) TINY_LOG_LEVEL(logger, TinyServer::LogLevel::Level::DEBUG)
 #define TINY_LOG_INFO(logger) TINY_LOG_LEVEL(logger, TinyServer::LogLevel::Level::INFO)
@@ -27,9 +39,9 @@ using Ref = std::shared_ptr<T>;
 #define TINY_LOG_FATAL(logger) TINY_LOG_LEVEL(logger, TinyServer::LogLevel::Level::FATAL)
 
 #define TINY_LOG_FORMAT_LEVEL(logger, level, fmt, ...)\
-    if (logger->getLevel() <= level)\
-    TinyServer::LogEventWarp(Ref<TinyServer::LogEvent>(new TinyServer::LogEvent(logger, level, __FILE__, __LINE__,\
-    0, time(0), TinyServer::GetThreadId(), TinyServer::Thread::GetName(), TinyServer::GetFiberId()))).getEvent()->format(fmt, ##__VA_ARGS__)
+    if (TINY_LOG_ENABLED(logger, level))\
+    TinyServer::LogEventWarp(logger, level, __FILE__, __LINE__,\
+    0, time(0), TinyServer::GetThreadId(), TinyServer::Thread::GetName(), TinyServer::GetFiberId()).getEvent()->format(fmt, ##__VA_ARGS__)
 
 #define TINY_LOG_FORMAT_DEBUG(logger, fmt, ...) TINY_LOG_FORMAT_LEVEL(logger, TinyServer::LogLevel::Level::DEBUG, fmt, ##__VA_ARGS__)
 #define TINY_LOG_FORMAT_INFO(logger, fmt, ...) TINY_LOG_FORMAT_LEVEL(logger, TinyServer::LogLevel::Level::INFO, fmt, ##__VA_ARGS__)
@@ -58,25 +70,72 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
+//直接写入可增长缓冲区的streambuf，缓冲区复用时不再分配内存
+class LogStreamBuf : public std::streambuf
+{
+public:
+    LogStreamBuf();
+    const char* data() const { return pbase(); }
+    size_t size() const { return pptr() - pbase(); }
+    size_t capacity() const { return m_buf.size(); }
+    void clear() { setp(&m_buf[0], &m_buf[0] + m_buf.size()); }
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+    void reserve(size_t n);
+
+private:
+    std::string m_buf;
+};
+
+//日志内容流，由线程局部的池分配和回收
+class LogStream : public std::ostream
+{
+public:
+    LogStream();
+    const char* data() const { return m_buf.data(); }
+    size_t size() const { return m_buf.size(); }
+    //恢复到刚构造时的状态(清空内容、格式标志和错误状态)
+    void reset();
+
+    //从当前线程的池中取出一个，没有时新建
+    static LogStream* Acquire();
+    //归还到当前线程的池中
+    static void Release(LogStream* stream);
+
+private:
+    LogStreamBuf m_buf;
+};
+
 class LogEvent
 {
 public:
+    //threadName在事件的生命周期内必须有效(宏里传入的是线程局部的线程名)
     LogEvent(const Ref<Logger>& logger, LogLevel::Level level, 
         const char* file, uint32_t line, uint32_t elapse, 
-        uint32_t time, uint32_t threadId, std::string threadName, uint32_t fiberId)
+        uint32_t time, uint32_t threadId, const std::string& threadName, uint32_t fiberId)
         : m_logger(logger), m_level(level), m_file(file), 
         m_line(line), m_elapse(elapse), m_time(time), 
-        m_threadId(threadId), m_threadName(threadName), m_fiberId(fiberId) {}
+        m_threadId(threadId), m_threadName(&threadName), m_fiberId(fiberId), 
+        m_ss(LogStream::Acquire()) {}
+    ~LogEvent() { LogStream::Release(m_ss); }
+    LogEvent(const LogEvent&) = delete;
+    LogEvent& operator=(const LogEvent&) = delete;
 
     const char* getFile() const { return m_file; }
     uint32_t getLine() const { return m_line; }
     uint32_t getElapse() const { return m_elapse; }
     uint32_t getTime() const { return m_time; }
     uint32_t getThreadId() const { return m_threadId; }
-    std::string getThreadName() const { return m_threadName; }
+    const std::string& getThreadName() const { return *m_threadName; }
     uint32_t getcFiberId() const { return m_fiberId; }
-    std::string getContent() const { return m_ss.str(); }
-    std::stringstream& getSS() { return m_ss; }
+    std::string getContent() const { return std::string(m_ss->data(), m_ss->size()); }
+    const char* getContentData() const { return m_ss->data(); }
+    size_t getContentSize() const { return m_ss->size(); }
+    std::ostream& getSS() { return *m_ss; }
     const Ref<Logger>& getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
 
@@ -88,17 +147,7 @@ public:
         va_end(al);
     }
 
-    void format(const char* fmt, va_list al)
-    {
-        char* buf = nullptr;
-        int len = vasprintf(&buf, fmt, al);
-        if (len != -1)
-        {
-            m_ss << std::string(buf, len);
-            free(buf);
-        }
-    }
-
+    void format(const char* fmt, va_list al);
 
 private:
     Ref<Logger> m_logger;
@@ -109,47 +158,76 @@ private:
     uint32_t m_elapse;          //程序启动到现在的毫秒数
     uint32_t m_time;            //时间戳
     uint32_t m_threadId;        //线程id
-    std::string m_threadName;   //线程名称
+    const std::string* m_threadName;    //线程名称
     uint32_t m_fiberId;         //协程id
-    std::stringstream m_ss;     //消息内容
+    LogStream* m_ss;            //消息内容
 };
 
 class LogEventWarp
 {
 public:
     LogEventWarp(const Ref<LogEvent>& event);
+    //事件直接构造在LogEventWarp内部(宏里位于栈上)，m_event是不持有所有权的Ref
+    //appender只在log调用期间使用事件，不能保存这个Ref
+    LogEventWarp(const Ref<Logger>& logger, LogLevel::Level level, 
+        const char* file, uint32_t line, uint32_t elapse, 
+        uint32_t time, uint32_t threadId, const std::string& threadName, uint32_t fiberId);
 
     ~LogEventWarp();
 
     const Ref<LogEvent>& getEvent() const { return m_event; }
-    std::stringstream& getSS();
+    std::ostream& getSS();
 
 private:
     Ref<LogEvent> m_event;
+    bool m_inline = false;
+    typename std::aligned_storage<sizeof(LogEvent), alignof(LogEvent)>::type m_storage;
 };
 
+//模式串在构造时编译成一组指令，格式化时顺序执行，直接追加到调用者的缓冲区
 class LogFormatter
 {
 public:
     LogFormatter(const std::string& pattern);
     std::string format(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event);
+    //追加到out末尾
+    void format(std::string& out, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event);
     void init();
 
 public:
-    class FormatItem
+    struct Op
     {
-    public:
-        FormatItem(const std::string& fmt = "") {}
-        virtual ~FormatItem() {}
-        virtual void format(std::ostream& os, LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) = 0;
+        enum Type
+        {
+            STRING,         //%%和普通文本
+            MESSAGE,        //%m
+            LEVEL,          //%p
+            ELAPSE,         //%r
+            LOGGER_NAME,    //%c
+            THREAD_ID,      //%t
+            NEWLINE,        //%n
+            DATETIME,       //%d{fmt}
+            FILENAME,       //%f
+            LINE,           //%l
+            TAB,            //%T
+            FIBER_ID,       //%F
+            THREAD_NAME     //%N
+        };
+        Type type;
+        std::string arg;    //STRING为文本，DATETIME为strftime格式
     };
 
     bool isError() { return m_error; }
     const std::string getPattern() const { return m_pattern; }
 
+private:
+    //%d按秒缓存strftime的结果
+    void formatTime(std::string& out, size_t index, time_t time);
+
 private:
     std::string m_pattern;
-    std::vector<Ref<FormatItem>> m_items;
+    std::vector<Op> m_ops;
+    uint64_t m_id;              //区分线程局部的时间缓存
     bool m_error = false;
 };
 
@@ -213,6 +291,65 @@ private:
     uint64_t m_lastTime = 0;
 };
 
+//Output to File Appender asynchronously
+//业务线程只把格式化好的日志追加到前台缓冲，后台线程批量write到文件
+//前台缓冲写满后和后台缓冲交换并唤醒刷盘线程，刷盘线程至少每flushInterval毫秒刷一次
+//两个缓冲都满时按overflow处理: BLOCK阻塞等待刷盘，DROP丢弃并计数
+class AsyncFileLog : public LogAppender
+{
+public:
+    enum Overflow
+    {
+        BLOCK = 0,
+        DROP = 1
+    };
+
+    AsyncFileLog(const std::string& fileName, uint32_t flushInterval = 1000, 
+        uint32_t bufferSize = 1024 * 1024, Overflow overflow = BLOCK);
+    ~AsyncFileLog();
+    void log(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override;
+    std::string toYamlString() override;
+    //刷盘线程在下一次写入前重新打开文件
+    void reopen();
+    //等待调用之前写入的日志全部落盘
+    void flush();
+    uint64_t getDropped() const { return m_dropped; }
+
+private:
+    void run();
+    bool openFile();
+    //fork之后子进程中没有刷盘线程，重新启动(持有m_bufMutex时调用)
+    void restartAfterFork();
+
+    //pthread_atfork的回调: fork前锁住所有AsyncFileLog的m_mutex和m_bufMutex，fork后在父子进程中释放
+    //子进程中的条件变量可能还记录着父进程的等待者，重新初始化
+    friend struct ForkIniter;
+    static void PrepareFork();
+    static void ParentAfterFork();
+    static void ChildAfterFork();
+
+private:
+    std::string m_fileName;
+    uint32_t m_flushInterval;
+    size_t m_bufferSize;
+    Overflow m_overflow;
+    int m_fd = -1;
+    MutexType m_bufMutex;
+    Condition m_cond;           //唤醒刷盘线程
+    Condition m_freeCond;       //后台缓冲空出来或者有数据落盘
+    std::string m_front;        //业务线程写入
+    std::string m_back;         //写满等待刷盘
+    bool m_backFull = false;
+    bool m_stop = false;
+    bool m_reopen = false;
+    bool m_flushRequest = false;
+    uint64_t m_appended = 0;    //写入缓冲的总字节数
+    uint64_t m_written = 0;     //已经落盘的总字节数
+    std::atomic<uint64_t> m_dropped = {0};
+    Thread* m_thread = nullptr;
+    int m_forkGeneration;
+};
+
 
 class Logger : public std::enable_shared_from_this<Logger>
 {
@@ -234,8 +371,8 @@ public:
 
     void fatal(Ref<LogEvent>& event);
 
-    LogLevel::Level getLevel() const { return m_level; }
-    void setLevel(LogLevel::Level level) { m_level = level; } 
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel::Level level) { m_level.store(level, std::memory_order_relaxed); } 
 
     void addAppender(const Ref<LogAppender>& appender);
     void removeAppender(Ref<LogAppender>& appender);
@@ -278,11 +415,11 @@ public:
         return m_formatter; 
     }
 
-    std::string getName() const { return m_name; }
+    const std::string& getName() const { return m_name; }
 
 private:
     std::string m_name;
-    LogLevel::Level m_level;
+    std::atomic<LogLevel::Level> m_level;   //每条日志语句都会读，可能和setLevel并发
     MutexType m_mutex;
     Ref<LogFormatter> m_formatter;
     std::list<Ref<LogAppender>> m_appenders;
@@ -323,17 +460,23 @@ using LoggerMgr = TinyServer::SingletonPtr<LoggerManager>;
 
 struct LogAppenderDefine
 {
-    int type = 0; //1==>File, 2==>Console
+    int type = 0; //1==>File, 2==>Console, 3==>AsyncFile
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string formatter;
     std::string file;
+    uint32_t flush_interval = 1000;         //AsyncFile: 刷盘间隔(毫秒)
+    uint32_t buffer_size = 1024 * 1024;     //AsyncFile: 单个缓冲大小
+    std::string overflow = "block";         //AsyncFile: 缓冲满时block或drop
 
     bool operator==(const LogAppenderDefine& oth) const 
     {
         return type == oth.type
             && level == oth.level
             && formatter == oth.formatter
-            && file == oth.file;
+            && file == oth.file
+            && flush_interval == oth.flush_interval
+            && buffer_size == oth.buffer_size
+            && overflow == oth.overflow;
     }
 };
 
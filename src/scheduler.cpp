@@ -2,16 +2,28 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
 
 namespace TinyServer
 {
 static Ref<Logger> logger = TINY_LOG_NAME("system");
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_fiber = nullptr;   // ==> run fiber
+static thread_local int t_worker = -1;          // ==> 工作线程在m_queues中的下标
+
+static Ref<ConfigVar<bool>> scheduler_work_stealing = Config::Lookup("scheduler.work_stealing", 
+    true, "per-thread task queues with work stealing, false to share one queue");
 
 Scheduler::Scheduler(size_t threads, bool use_call, const std::string& name)
-    : m_name(name), m_threadCount(0), m_activateThreadCount(0), m_idleThreadCount(), m_stopping(true), m_autoStop(false), m_rootThread(0)
+    : m_name(name), m_workStealing(scheduler_work_stealing->getValue())
+    , m_threadCount(0), m_activateThreadCount(0), m_idleThreadCount(), m_stopping(true), m_autoStop(false), m_rootThread(0)
 {
+    TINY_ASSERT(threads > 0);
+    //工作线程下标与m_threadIds一致: use_call时root线程为0
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_queues.push_back(new WorkQueue);
+    }
     if (use_call)
     {
         //创建主协程main_fiber
@@ -23,7 +35,9 @@ Scheduler::Scheduler(size_t threads, bool use_call, const std::string& name)
         m_rootFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, true));
         Thread::SetName(m_name);
         t_fiber = m_rootFiber.get();
+        t_worker = 0;
         m_rootThread = GetThreadId();
+        m_queues[0]->thread = m_rootThread;
         m_threadIds.push_back(m_rootThread);
     }
     else
@@ -49,6 +63,11 @@ Scheduler::~Scheduler()
     if (GetThis() == this)
     {
         t_scheduler = nullptr;
+        t_worker = -1;
+    }
+    for (auto queue : m_queues)
+    {
+        delete queue;
     }
 }
 
@@ -64,9 +83,15 @@ void Scheduler::start()
         TINY_ASSERT(m_threads.empty());
 
         m_threads.reserve(m_threadCount);
+        size_t offset = m_rootFiber ? 1 : 0;
         for (size_t i = 0; i < m_threadCount; ++i)
         {
-            m_threads.push_back(Ref<Thread>(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i))));
+            int index = i + offset;
+            m_threads.push_back(Ref<Thread>(new Thread([this, index](){
+                t_worker = index;
+                m_queues[index]->thread = GetThreadId();
+                run();
+            }, m_name + "_" + std::to_string(i))));
             m_threadIds.push_back(m_threads[i]->getId());    
         }   
     }
@@ -139,8 +164,7 @@ void Scheduler::stop()
 
 bool Scheduler::stopping()
 {
-    MutexType::MutexLockGuard lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activateThreadCount == 0;
+    return m_autoStop && m_stopping && m_pendingTasks == 0 && m_activateThreadCount == 0;
 }
 
 void Scheduler::idle()
@@ -163,6 +187,199 @@ void Scheduler::setThis()
     t_scheduler = this;
 }
 
+int Scheduler::getWorkerIndex() const
+{
+    return t_scheduler == this ? t_worker : -1;
+}
+
+Scheduler::WorkQueue* Scheduler::pickQueue()
+{
+    if (!m_workStealing)
+        return m_queues[0];
+    int index = getWorkerIndex();
+    if (index < 0)
+        index = m_nextQueue++ % m_queues.size();
+    return m_queues[index];
+}
+
+Scheduler::WorkQueue* Scheduler::findQueue(int thread)
+{
+    int index = getWorkerIndex();
+    if (index >= 0 && m_queues[index]->thread == thread)
+        return m_queues[index];
+    for (auto queue : m_queues)
+    {
+        if (queue->thread == thread)
+            return queue;
+    }
+    return nullptr;
+}
+
+int Scheduler::TargetThread(const FiberAndThread& ft)
+{
+    if (ft.threadId != -1 || !ft.fiber)
+        return ft.threadId;
+    return ft.fiber->getAffinity();
+}
+
+bool Scheduler::scheduleNoLock(FiberAndThread& ft)
+{
+    WorkQueue* queue = nullptr;
+    bool pinned = false;
+    int thread = TargetThread(ft);
+    if (thread != -1)
+    {
+        queue = findQueue(thread);
+        pinned = queue != nullptr;
+        if (pinned)
+            ft.threadId = thread;
+    }
+    if (!queue)
+        queue = pickQueue();
+
+    std::deque<FiberAndThread>& tasks = pinned ? queue->inbox : queue->tasks;
+    MutexType::MutexLockGuard lock(queue->mutex);
+    bool need_tickle = tasks.empty();
+    tasks.push_back(FiberAndThread());
+    tasks.back().swap(ft);
+    ++m_pendingTasks;
+    if (pinned)
+        ++queue->pinned;
+    return need_tickle;
+}
+
+void Scheduler::scheduleBatch(std::vector<FiberAndThread>& tasks)
+{
+    if (tasks.empty())
+        return;
+    bool need_tickle = false;
+    size_t count = 0;
+    {
+        WorkQueue* queue = pickQueue();
+        MutexType::MutexLockGuard lock(queue->mutex);
+        for (auto& ft : tasks)
+        {
+            TINY_ASSERT(ft.fiber || ft.cb);
+            //指定了线程的任务放入该线程的inbox，不参与窃取
+            if (TargetThread(ft) != -1)
+                continue;
+            queue->tasks.push_back(FiberAndThread());
+            queue->tasks.back().swap(ft);
+            ++count;
+        }
+        //多个任务时唤醒其他线程来窃取
+        need_tickle = count > 0 && (queue->tasks.size() == count || count > 1);
+        m_pendingTasks += count;
+    }
+    for (auto& ft : tasks)
+    {
+        if (ft.fiber || ft.cb)
+            need_tickle = scheduleNoLock(ft) || need_tickle;
+    }
+    tasks.clear();
+    if (need_tickle)
+    {
+        tickle();
+    }
+}
+
+bool Scheduler::popTask(std::deque<FiberAndThread>& tasks, FiberAndThread& ft, bool& tickle_me, bool from_back)
+{
+    size_t size = tasks.size();
+    for (size_t i = 0; i < size; ++i)
+    {
+        size_t pos = from_back ? size - 1 - i : i;
+        FiberAndThread& item = tasks[pos];
+        TINY_ASSERT(item.fiber || item.cb);
+        //协程还没有完全切出(其他线程刚把它重新投递)，暂时跳过
+        if (item.fiber && item.fiber->getState() == Fiber::EXEC)
+        {
+            tickle_me = true;
+            continue;
+        }
+        ft.swap(item);
+        tasks.erase(tasks.begin() + pos);
+        ++m_activateThreadCount;
+        --m_pendingTasks;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::takeTask(FiberAndThread& ft, bool& tickle_me)
+{
+    size_t index = getWorkerIndex();
+    TINY_ASSERT(index < m_queues.size());
+    WorkQueue* own = m_queues[index];
+    {
+        MutexType::MutexLockGuard lock(own->mutex);
+        if (popTask(own->inbox, ft, tickle_me, false))
+        {
+            --own->pinned;
+            return true;
+        }
+        if (m_workStealing && popTask(own->tasks, ft, tickle_me, false))
+        {
+            tickle_me = tickle_me || !own->tasks.empty();
+            return true;
+        }
+    }
+
+    if (!m_workStealing)
+    {
+        WorkQueue* shared = m_queues[0];
+        MutexType::MutexLockGuard lock(shared->mutex);
+        bool found = popTask(shared->tasks, ft, tickle_me, false);
+        tickle_me = tickle_me || (found && !shared->tasks.empty());
+        return found;
+    }
+
+    //从随机的一个队列开始窃取，从尾部取
+    size_t count = m_queues.size();
+    if (count <= 1 || m_pendingTasks == 0)
+        return false;
+    static thread_local uint32_t s_seed = GetThreadId();
+    s_seed = s_seed * 1103515245 + 12345;
+    size_t start = (s_seed >> 16) % count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t victim = (start + i) % count;
+        if (victim == index)
+            continue;
+        WorkQueue* queue = m_queues[victim];
+        MutexType::MutexLockGuard lock(queue->mutex);
+        if (popTask(queue->tasks, ft, tickle_me, true))
+        {
+            tickle_me = tickle_me || !queue->tasks.empty();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasIdlePinnedTasks()
+{
+    for (auto queue : m_queues)
+    {
+        if (queue->pinned > 0 && queue->idle)
+            return true;
+    }
+    return false;
+}
+
+bool Scheduler::hasRunnableTask()
+{
+    int index = getWorkerIndex();
+    if (index >= 0 && m_queues[index]->pinned > 0)
+        return true;
+    size_t pinned = 0;
+    for (auto queue : m_queues)
+    {
+        pinned += queue->pinned;
+    }
+    return m_pendingTasks > pinned;
+}
+
 void Scheduler::run()
 {
     TINY_LOG_INFO(logger) << "run";
@@ -180,33 +397,11 @@ void Scheduler::run()
     {
         ft.reset();
         bool tickle_me = false;
-        bool is_active = false;
+        bool is_active = takeTask(ft, tickle_me);
+        //tickle只唤醒任意一个idle线程，专属任务的目标线程还在idle时继续传递
+        if (!is_active && m_pendingTasks > 0 && hasIdlePinnedTasks())
         {
-            MutexType::MutexLockGuard lock(m_mutex);
-            auto iter = m_fibers.begin();
-            while (iter != m_fibers.end())
-            {
-                if (iter->threadId != -1 && iter->threadId != GetThreadId())
-                {
-                    ++iter;
-                    tickle_me = true;
-                    continue;
-                } 
-                TINY_ASSERT(iter->fiber || iter->cb);
-                if (iter->fiber && iter->fiber->getState() == Fiber::EXEC)
-                {
-                    ++iter;
-                    continue;
-                }
-                //TINY_LOG_INFO(logger) << "get task from queue";
-                ft = *iter;
-                tickle_me = true;
-                //list erase之后迭代器也被销毁了，不可再使用
-                m_fibers.erase(iter);
-                ++m_activateThreadCount;
-                is_active = true;
-                break;
-            }
+            tickle_me = true;
         }
 
         if (tickle_me)
@@ -226,6 +421,10 @@ void Scheduler::run()
             {
                 ft.fiber->setState(Fiber::HOLD);
             }
+            else
+            {
+                Fiber::Recycle(ft.fiber);
+            }
             ft.reset();
         }
         else if (ft.cb)
@@ -236,7 +435,7 @@ void Scheduler::run()
             }
             else
             {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber = Fiber::Create(ft.cb);
             }
             ft.reset();
             cb_fiber->swapIn();
@@ -266,11 +465,15 @@ void Scheduler::run()
             if (idle_fiber->getState() == Fiber::TERM)
             {
                 TINY_LOG_INFO(logger) << "idle fiber term";
+                Fiber::ClearCache();
                 break;
             }
+            WorkQueue* own = m_queues[getWorkerIndex()];
+            own->idle = true;
             ++m_idleThreadCount;
             idle_fiber->swapIn();
             --m_idleThreadCount;
+            own->idle = false;
             if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT)
             {
                 idle_fiber->setState(Fiber::HOLD);
@@ -1,5 +1,7 @@
 #pragma once
 #include <memory>
+#include <deque>
+#include <vector>
 #include "fiber.h"
 
 /////////////////////////////////////////////////////////////////////
@@ -34,9 +36,10 @@ public:
     void schedule(FiberOrCb fc, int threadId = -1)
     {
         bool need_tickle = false;
+        FiberAndThread ft(fc, threadId);
+        if (ft.fiber || ft.cb)
         {
-            MutexType::MutexLockGuard lock(m_mutex);
-            scheduleNoLock(fc, threadId);
+            need_tickle = scheduleNoLock(ft);
         }
         if (need_tickle)
         {
@@ -44,15 +47,24 @@ public:
         }
     }
 
+    //批量投递到同一个队列，只加一次锁
     template<typename InputIterator>
     void schedule(InputIterator begin, InputIterator end)
     {
         bool need_tickle = false;
         {
-            MutexType::MutexLockGuard lock(m_mutex);
+            WorkQueue* queue = pickQueue();
+            MutexType::MutexLockGuard lock(queue->mutex);
+            need_tickle = queue->tasks.empty();
             while (begin != end)
             {
-                need_tickle = scheduleNoLock(&(*begin)) || need_tickle;
+                FiberAndThread ft(&(*begin), -1);
+                if (ft.fiber || ft.cb)
+                {
+                    queue->tasks.push_back(FiberAndThread());
+                    queue->tasks.back().swap(ft);
+                    ++m_pendingTasks;
+                }
                 ++begin;
             }
         }
@@ -65,24 +77,15 @@ public:
     void run();
 
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
+    //所有工作线程的线程id(use_call时包括root线程)，可以作为schedule的threadId
+    const std::vector<int>& getThreadIds() const { return m_threadIds; }
 
 protected:
     virtual void tickle();
+    //是否有当前线程可以执行的任务(idle阻塞前检查，避免错过tickle)
+    bool hasRunnableTask();
 
-private:
-    template<typename FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int threadId = -1)  
-    {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, threadId);
-        if (ft.fiber || ft.cb)
-        {
-            m_fibers.push_back(ft);
-        }
-        return need_tickle;
-    }
-
-private:
+protected:
     struct FiberAndThread
     {
         Ref<Fiber> fiber;
@@ -110,6 +113,13 @@ private:
         FiberAndThread()
             : threadId(-1) {}
 
+        void swap(FiberAndThread& other)
+        {
+            fiber.swap(other.fiber);
+            cb.swap(other.cb);
+            std::swap(threadId, other.threadId);
+        }
+
         void reset()
         {
             fiber = nullptr;
@@ -118,11 +128,48 @@ private:
         }
     };
 
+    //每个工作线程一个任务队列
+    //tasks: 本线程从头部取，其他线程空闲时从尾部窃取
+    //inbox: 指定了threadId的任务，只能由本线程执行
+    struct WorkQueue
+    {
+        MutexType mutex;
+        std::deque<FiberAndThread> tasks;
+        std::deque<FiberAndThread> inbox;
+        std::atomic<size_t> pinned = {0};   //inbox中的任务数
+        std::atomic<bool> idle = {false};   //该线程是否处于idle
+        std::atomic<int> thread = {-1};     //所属线程的id，线程启动时设置
+    };
+
+    //放入对应的任务队列，返回是否需要tickle
+    bool scheduleNoLock(FiberAndThread& ft);
+    //一批任务一次加锁放入同一个队列，tasks会被清空
+    void scheduleBatch(std::vector<FiberAndThread>& tasks);
+    //当前线程投递任务的目标队列: 工作线程投递到自己的队列，外部线程轮询
+    WorkQueue* pickQueue();
+    //线程id对应的队列，不是本调度器的工作线程返回nullptr，不加锁
+    WorkQueue* findQueue(int thread);
+    //任务要执行的线程: 指定的threadId，否则为协程绑定的线程
+    static int TargetThread(const FiberAndThread& ft);
+    //依次从自己的inbox、tasks和其他线程的tasks中取任务
+    bool takeTask(FiberAndThread& ft, bool& tickle_me);
+    //取出第一个不在执行中的任务
+    bool popTask(std::deque<FiberAndThread>& tasks, FiberAndThread& ft, bool& tickle_me, bool from_back);
+    //当前线程在本调度器中的工作线程下标，不是工作线程返回-1
+    int getWorkerIndex() const;
+    //工作线程数(包括use_call时的root线程)
+    size_t getWorkerCount() const { return m_queues.size(); }
+    //是否有专属任务在等待一个处于idle的线程
+    bool hasIdlePinnedTasks();
+
 private:
     std::string m_name;
     MutexType m_mutex;
     std::vector<Ref<Thread>> m_threads;
-    std::list<FiberAndThread> m_fibers;
+    std::vector<WorkQueue*> m_queues;
+    std::atomic<size_t> m_pendingTasks = {0};   //所有队列中的任务数
+    std::atomic<size_t> m_nextQueue = {0};      //外部线程投递的轮询下标
+    bool m_workStealing;                        //false时所有任务共用m_queues[0]
     Ref<Fiber> m_rootFiber;
 
 protected:
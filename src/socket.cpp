@@ -153,7 +153,7 @@ bool Socket::init(int sock)
     return false;
 }
 
-bool Socket::bind(const Ref<Address> addr)
+bool Socket::bind(const Ref<Address> addr, bool reuse_port)
 {
     if (TINY_UNLICKLY(!isValid()))
     {
@@ -161,6 +161,11 @@ bool Socket::bind(const Ref<Address> addr)
         if (TINY_UNLICKLY(!isValid()))
             return false;
     }
+    if (reuse_port && !setOption(SOL_SOCKET, SO_REUSEPORT, 1))
+    {
+        TINY_LOG_ERROR(logger) << "setsockopt SO_REUSEPORT error errno = " << errno << " strerr = " << strerror(errno);
+        return false;
+    }
     if (TINY_UNLICKLY(addr->getFamily() != m_family))
     {
         TINY_LOG_ERROR(logger) << "bind sock.family(" << m_family << ") addr.family(" 
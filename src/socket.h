@@ -58,7 +58,8 @@ public:
 
     Ref<Socket> accept();
 
-    bool bind(const Ref<Address> addr);
+    //reuse_port为true时在bind之前设置SO_REUSEPORT
+    bool bind(const Ref<Address> addr, bool reuse_port = false);
     bool connect(const Ref<Address>& addr, uint64_t timeout_ms = -1);
     bool listen(int backlog = SOMAXCONN);
     bool close();
@@ -36,28 +36,38 @@ bool TCPServer::bind(Ref<Address> addr)
 
 bool TCPServer::bind(std::vector<Ref<Address>>& addrs, std::vector<Ref<Address>>& fails)
 {
+    std::vector<int> threads(1, -1);
+    if (m_reusePort && !m_worker->getThreadIds().empty())
+    {
+        threads = m_worker->getThreadIds();
+    }
     for (auto& item : addrs)
     {
-        Ref<Socket> sock = Socket::CreateTCP(item);
-        if (!sock->bind(item))
+        for (int thread : threads)
         {
-            TINY_LOG_ERROR(logger) << "bind fail errno = " << errno << " errstr = " << strerror(errno)
-                << " addr = [" << item->toString() << "]";
-            fails.push_back(item);
-            continue;
+            Ref<Socket> sock = Socket::CreateTCP(item);
+            if (!sock->bind(item, m_reusePort))
+            {
+                TINY_LOG_ERROR(logger) << "bind fail errno = " << errno << " errstr = " << strerror(errno)
+                    << " addr = [" << item->toString() << "]";
+                fails.push_back(item);
+                break;
+            }
+            if (!sock->listen())
+            {
+                TINY_LOG_ERROR(logger) << "listen fail errno = " << errno << " errstr = " << strerror(errno)
+                    << " addr = [" << item->toString() << "]";
+                fails.push_back(item);
+                break;
+            }
+            m_sockets.push_back(sock);
+            m_acceptThreads.push_back(thread);
         }
-        if (!sock->listen())
-        {
-            TINY_LOG_ERROR(logger) << "listen fail errno = " << errno << " errstr = " << strerror(errno)
-                << " addr = [" << item->toString() << "]";
-            fails.push_back(item);
-            continue;
-        }
-        m_sockets.push_back(sock);
     }
     if (!fails.empty())
     {
         m_sockets.clear();
+        m_acceptThreads.clear();
         return false;
     }
     for (auto& item : m_sockets)
@@ -69,13 +79,20 @@ bool TCPServer::bind(std::vector<Ref<Address>>& addrs, std::vector<Ref<Address>>
 
 void TCPServer::startAccept(Ref<Socket> sock)
 {
+    //SO_REUSEPORT模式下accept协程绑定在监听socket所属的线程(见start)，连接也交给这个线程
+    int thread = Fiber::GetThis()->getAffinity();
+    auto self = shared_from_this();
     while (!m_isStop)
     {
         Ref<Socket> client = sock->accept();
         if (client)
         {
             client->setRecvTimeout(m_recvTimeout);
-            m_worker->schedule(std::bind(&TCPServer::handleClient, shared_from_this(), client));
+            m_worker->schedule([self, client, thread](){
+                //等待读写事件后也回到这个线程
+                Fiber::GetThis()->setAffinity(thread);
+                self->handleClient(client);
+            }, thread);
         }
         else
         {
@@ -94,9 +111,22 @@ bool TCPServer::start()
     if (!m_isStop)
         return true;
     m_isStop = false;
-    for (auto& sock : m_sockets)
+    for (size_t i = 0; i < m_sockets.size(); ++i)
     {
-        m_acceptWorker->schedule(std::bind(&TCPServer::startAccept, shared_from_this(), sock));
+        if (m_acceptThreads[i] != -1)
+        {
+            auto self = shared_from_this();
+            Ref<Socket> sock = m_sockets[i];
+            int thread = m_acceptThreads[i];
+            m_worker->schedule([self, sock, thread](){
+                Fiber::GetThis()->setAffinity(thread);
+                self->startAccept(sock);
+            }, thread);
+        }
+        else
+        {
+            m_acceptWorker->schedule(std::bind(&TCPServer::startAccept, shared_from_this(), m_sockets[i]));
+        }
     }
     return true;
 }
@@ -105,13 +135,15 @@ void TCPServer::stop()
 {
     m_isStop = true;
     auto self = shared_from_this();
-    m_acceptWorker->schedule([this, self](){
+    IOManager* iom = m_reusePort ? m_worker : m_acceptWorker;
+    iom->schedule([this, self](){
         for (auto& sock : self->m_sockets)
         {
             sock->cancelAll();
             sock->close();
         }
         self->m_sockets.clear();
+        self->m_acceptThreads.clear();
     });
 }
 
@@ -24,6 +24,10 @@ public:
     void setRecvTimeout(uint64_t v) { m_recvTimeout = v; }
     void setName(const std::string& name) { m_name = name; }
     bool isStop() const { return m_isStop; }
+    //SO_REUSEPORT模式，需要在bind之前设置: 每个地址为m_worker的每个线程各创建一个监听socket
+    //每个线程只accept自己的socket，连接也在本线程处理，不经过其他线程
+    void setReusePort(bool v) { m_reusePort = v; }
+    bool isReusePort() const { return m_reusePort; }
 
 protected:
     virtual void handleClient(Ref<Socket> client);
@@ -31,11 +35,13 @@ protected:
 
 private:
     std::vector<Ref<Socket>> m_sockets;
+    std::vector<int> m_acceptThreads;   //m_sockets对应的accept线程，-1表示不指定
     IOManager* m_worker;    //处理accept状态之后的socket，主要是socket上的读写事件(handleClient)
     IOManager* m_acceptWorker;  //处理accept状态之前的已bind的socket操作(startAccept)
     uint64_t m_recvTimeout;
     std::string m_name;
     bool m_isStop;
+    bool m_reusePort = false;
 };
 
 
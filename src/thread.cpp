@@ -1,6 +1,7 @@
 #include "thread.h"
 #include "log.h"
 #include "util.h"
+#include <time.h>
 
 namespace TinyServer
 {
@@ -33,13 +34,65 @@ void Semaphore::notify()
     }
 }
 
+Condition::Condition(MutexLock& mutex)
+    : m_mutex(mutex)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+Condition::~Condition()
+{
+    pthread_cond_destroy(&m_cond);
+}
+
+void Condition::wait()
+{
+    pthread_cond_wait(&m_cond, m_mutex.getMutex());
+}
+
+bool Condition::waitFor(uint64_t ms)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += ms % 1000 * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(&m_cond, m_mutex.getMutex(), &ts) == 0;
+}
+
+void Condition::notify()
+{
+    pthread_cond_signal(&m_cond);
+}
+
+void Condition::notifyAll()
+{
+    pthread_cond_broadcast(&m_cond);
+}
+
+void Condition::reinitAfterFork()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
 
 Thread* Thread::GetThis()
 {
     return t_thread;
 }
 
-std::string Thread::GetName()
+const std::string& Thread::GetName()
 {
     return t_name;
 }
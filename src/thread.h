@@ -168,11 +168,32 @@ public:
         pthread_mutex_unlock(&m_mutex);
     }
 
+    pthread_mutex_t* getMutex() { return &m_mutex; }
 
 private:
     pthread_mutex_t m_mutex;
 };
 
+//条件变量，调用wait系列函数时必须已经持有mutex
+class Condition : public Noncopyable
+{
+public:
+    explicit Condition(MutexLock& mutex);
+    ~Condition();
+
+    void wait();
+    //最多等待ms毫秒，超时返回false
+    bool waitFor(uint64_t ms);
+    void notify();
+    void notifyAll();
+    //fork后在子进程中调用: 父进程中等待的线程在子进程里不存在，不能destroy，直接重新初始化
+    void reinitAfterFork();
+
+private:
+    MutexLock& m_mutex;
+    pthread_cond_t m_cond;
+};
+
 class RWLock : public Noncopyable
 {
 public:
@@ -219,7 +240,7 @@ public:
 
 
     static Thread* GetThis();
-    static std::string GetName();
+    static const std::string& GetName();
     static void SetName(std::string name);
 
 // private:
@@ -1,10 +1,279 @@
 #include "timer.h"
 #include "util.h"
+#include "config.h"
+#include "macro.h"
+#include <algorithm>
 
 
 namespace TinyServer
 {
 
+static Ref<ConfigVar<bool>> timer_wheel_enable = Config::Lookup("timer.wheel.enable", 
+    false, "use per-thread hierarchical timing wheels instead of the ordered set");
+
+//分层时间轮，刻度1ms: 第0层256个槽，第1~4层各64个槽，覆盖2^32ms
+//添加和取消都是O(1)，到期时逐刻度推进，高层的槽在低层转完一圈时下放(cascade)
+class TimingWheel
+{
+public:
+    typedef MutexLock MutexType;
+
+    static const uint32_t ROOT_BITS = 8;
+    static const uint32_t LEVEL_BITS = 6;
+    static const uint32_t ROOT_SIZE = 1 << ROOT_BITS;
+    static const uint32_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const uint32_t LEVELS = 4;
+    static const uint32_t SLOTS = ROOT_SIZE + LEVEL_SIZE * LEVELS;
+
+    TimingWheel(std::atomic<size_t>& count)
+        : m_count(count), m_current(GetCurrentMs())
+    {
+        for (uint32_t i = 0; i < SLOTS; ++i)
+        {
+            m_slots[i] = nullptr;
+        }
+    }
+
+    ~TimingWheel()
+    {
+        std::vector<Ref<Timer>> timers;
+        for (uint32_t i = 0; i < SLOTS; ++i)
+        {
+            while (m_slots[i])
+            {
+                timers.push_back(nullptr);
+                timers.back().swap(m_slots[i]->m_self);
+                unlink(m_slots[i]);
+            }
+        }
+    }
+
+    //返回是否比上次getNext报告的时间更早
+    bool add(const Ref<Timer>& timer)
+    {
+        MutexType::MutexLockGuard lock(m_mutex);
+        link(timer.get());
+        timer->m_wheel = this;
+        timer->m_self = timer;
+        ++m_count;
+        if (timer->m_next < m_reported)
+        {
+            m_reported = timer->m_next;
+            return true;
+        }
+        return false;
+    }
+
+    bool cancel(Timer* timer)
+    {
+        Ref<Timer> self;
+        MutexType::MutexLockGuard lock(m_mutex);
+        if (!timer->m_cb || timer->m_wheel != this)
+            return false;
+        timer->m_cb = nullptr;
+        unlink(timer);
+        timer->m_wheel = nullptr;
+        //self在锁释放后才析构
+        self.swap(timer->m_self);
+        --m_count;
+        return true;
+    }
+
+    //重新设置执行时间，at_front返回是否比上次getNext报告的时间更早
+    bool reset(Timer* timer, uint64_t ms, bool from_now, bool& at_front)
+    {
+        MutexType::MutexLockGuard lock(m_mutex);
+        if (!timer->m_cb || timer->m_wheel != this)
+            return false;
+        unlink(timer);
+        uint64_t start = from_now ? GetCurrentMs() : timer->m_next - timer->m_ms;
+        timer->m_ms = ms;
+        timer->m_next = start + ms;
+        link(timer);
+        at_front = timer->m_next < m_reported;
+        if (at_front)
+            m_reported = timer->m_next;
+        return true;
+    }
+
+    //距离下一个到期定时器的毫秒数，没有定时器返回~0ull
+    //只精确扫描第0层到下一次下放为止，否则返回到下一次下放的时间
+    uint64_t getNext(uint64_t now_time)
+    {
+        MutexType::MutexLockGuard lock(m_mutex);
+        if (m_size == 0)
+        {
+            m_reported = ~0ull;
+            return ~0ull;
+        }
+        //m_current正好在边界上时下放还没有做
+        uint64_t next = (m_current + ROOT_SIZE - 1) & ~(uint64_t)(ROOT_SIZE - 1);
+        if (m_rootCount > 0)
+        {
+            for (uint64_t t = m_current; t < next; ++t)
+            {
+                if (m_slots[t & (ROOT_SIZE - 1)])
+                {
+                    next = t;
+                    break;
+                }
+            }
+        }
+        m_reported = next;
+        return next > now_time ? next - now_time : 0;
+    }
+
+    void expire(uint64_t now_time, std::vector<std::function<void()>>& cbs)
+    {
+        std::vector<Ref<Timer>> done;
+        MutexType::MutexLockGuard lock(m_mutex);
+        if (m_size == 0)
+        {
+            m_current = now_time + 1;
+            return;
+        }
+        Timer* expired = nullptr;
+        if (now_time + 60 * 60 * 1000 < m_current)
+        {
+            //时钟回拨，全部视为到期
+            for (uint32_t i = 0; i < SLOTS; ++i)
+            {
+                spliceTo(i, expired);
+            }
+            m_current = now_time;
+        }
+        while (m_current <= now_time)
+        {
+            uint32_t index = m_current & (ROOT_SIZE - 1);
+            if (index == 0)
+            {
+                for (uint32_t level = 0; level < LEVELS; ++level)
+                {
+                    if (cascade(level) != 0)
+                        break;
+                }
+            }
+            if (m_rootCount == 0)
+            {
+                //第0层为空，直接跳到下一次下放
+                uint64_t next = (m_current | (ROOT_SIZE - 1)) + 1;
+                m_current = next <= now_time + 1 ? next : now_time + 1;
+                continue;
+            }
+            spliceTo(index, expired);
+            ++m_current;
+        }
+
+        while (expired)
+        {
+            Timer* timer = expired;
+            expired = timer->m_wheelNext;
+            timer->m_wheelPrev = timer->m_wheelNext = nullptr;
+            cbs.push_back(timer->m_cb);
+            if (timer->m_recurring)
+            {
+                timer->m_next = now_time + timer->m_ms;
+                link(timer);
+            }
+            else
+            {
+                timer->m_cb = nullptr;
+                timer->m_wheel = nullptr;
+                done.push_back(nullptr);
+                done.back().swap(timer->m_self);
+                --m_count;
+            }
+        }
+    }
+
+private:
+    uint32_t slotFor(uint64_t expires)
+    {
+        if (expires < m_current)
+            expires = m_current;
+        uint64_t delta = expires - m_current;
+        if (delta < ROOT_SIZE)
+            return expires & (ROOT_SIZE - 1);
+        for (uint32_t level = 0; level < LEVELS; ++level)
+        {
+            uint32_t shift = ROOT_BITS + level * LEVEL_BITS;
+            if (delta < (1ull << (shift + LEVEL_BITS)) || level == LEVELS - 1)
+            {
+                if (delta >= (1ull << (shift + LEVEL_BITS)))
+                    expires = m_current + (1ull << (shift + LEVEL_BITS)) - 1;
+                return ROOT_SIZE + level * LEVEL_SIZE + ((expires >> shift) & (LEVEL_SIZE - 1));
+            }
+        }
+        return 0;
+    }
+
+    void link(Timer* timer)
+    {
+        uint32_t slot = slotFor(timer->m_next);
+        timer->m_slot = slot;
+        timer->m_wheelPrev = nullptr;
+        timer->m_wheelNext = m_slots[slot];
+        if (m_slots[slot])
+            m_slots[slot]->m_wheelPrev = timer;
+        m_slots[slot] = timer;
+        if (slot < ROOT_SIZE)
+            ++m_rootCount;
+        ++m_size;
+    }
+
+    void unlink(Timer* timer)
+    {
+        if (timer->m_wheelPrev)
+            timer->m_wheelPrev->m_wheelNext = timer->m_wheelNext;
+        else
+            m_slots[timer->m_slot] = timer->m_wheelNext;
+        if (timer->m_wheelNext)
+            timer->m_wheelNext->m_wheelPrev = timer->m_wheelPrev;
+        timer->m_wheelPrev = timer->m_wheelNext = nullptr;
+        if (timer->m_slot < ROOT_SIZE)
+            --m_rootCount;
+        --m_size;
+    }
+
+    //把一个槽整体移到expired链表
+    void spliceTo(uint32_t slot, Timer*& expired)
+    {
+        while (m_slots[slot])
+        {
+            Timer* timer = m_slots[slot];
+            unlink(timer);
+            timer->m_wheelNext = expired;
+            expired = timer;
+        }
+    }
+
+    //把level层当前的槽重新放入时间轮，返回该层的下标(为0时需要继续下放上一层)
+    uint32_t cascade(uint32_t level)
+    {
+        uint32_t shift = ROOT_BITS + level * LEVEL_BITS;
+        uint32_t index = (m_current >> shift) & (LEVEL_SIZE - 1);
+        uint32_t slot = ROOT_SIZE + level * LEVEL_SIZE + index;
+        Timer* list = nullptr;
+        spliceTo(slot, list);
+        while (list)
+        {
+            Timer* timer = list;
+            list = timer->m_wheelNext;
+            link(timer);
+        }
+        return index;
+    }
+
+private:
+    MutexType m_mutex;
+    std::atomic<size_t>& m_count;   //TimerManager中所有时间轮的定时器总数
+    uint64_t m_current;             //下一个要处理的刻度
+    uint64_t m_reported = ~0ull;    //上次getNext报告的到期时间
+    size_t m_size = 0;
+    size_t m_rootCount = 0;         //第0层的定时器数量
+    Timer* m_slots[SLOTS];
+};
+
 bool Timer::Compare::operator()(const Ref<Timer>& lhs, const Ref<Timer>& rhs)
 {
     if (!lhs && !rhs)
@@ -23,6 +292,11 @@ bool Timer::Compare::operator()(const Ref<Timer>& lhs, const Ref<Timer>& rhs)
 
 bool Timer::cancle()
 {
+    if (m_manager->m_useWheel)
+    {
+        TimingWheel* wheel = m_wheel.load();
+        return wheel ? wheel->cancel(this) : false;
+    }
     TimerManager::RWMutexType::WriteLockGuard lock(m_manager->m_mutex);
     if (m_cb)
     {
@@ -36,6 +310,8 @@ bool Timer::cancle()
 
 bool Timer::refresh()
 {
+    if (m_manager->m_useWheel)
+        return resetInWheel(m_ms, true);
     TimerManager::RWMutexType::WriteLockGuard lock(m_manager->m_mutex);
     if (!m_cb)
         return false;
@@ -54,6 +330,8 @@ bool Timer::reset(uint64_t ms, bool from_now)
 {
     if (ms == m_ms && !from_now)
         return false;
+    if (m_manager->m_useWheel)
+        return resetInWheel(ms, from_now);
     TimerManager::RWMutexType::WriteLockGuard lock(m_manager->m_mutex);
     if (!m_cb)
         return false;
@@ -75,6 +353,23 @@ bool Timer::reset(uint64_t ms, bool from_now)
     return true;
 }
 
+bool Timer::resetInWheel(uint64_t ms, bool from_now)
+{
+    TimingWheel* wheel = m_wheel.load();
+    bool at_front = false;
+    if (!wheel || !wheel->reset(this, ms, from_now, at_front))
+        return false;
+    //与addTimer一致: 当前线程自己的时间轮在它下次进入idle时会重新计算超时，
+    //其他时间轮(共用的0号或别的线程的)提前时需要唤醒idle线程
+    if (at_front)
+    {
+        size_t shard = m_manager->getTimerShard();
+        if (shard == 0 || shard >= m_manager->m_wheels.size() || m_manager->m_wheels[shard] != wheel)
+            m_manager->onTimerInsertAtFront();
+    }
+    return true;
+}
+
 
 Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
     : m_ms(ms), m_cb(cb), m_recurring(recurring), m_manager(manager)
@@ -90,20 +385,43 @@ Timer::Timer(uint64_t now_time)
 
 
 TimerManager::TimerManager()
-    : m_previousTime(GetCurrentMs())
+    : m_previousTime(GetCurrentMs()), m_useWheel(timer_wheel_enable->getValue())
 {
-
+    if (m_useWheel)
+        initTimerShards(1);
 }
 
 
 TimerManager::~TimerManager()
 {
+    for (auto wheel : m_wheels)
+    {
+        delete wheel;
+    }
+}
 
+void TimerManager::initTimerShards(size_t shards)
+{
+    if (!m_useWheel)
+        return;
+    TINY_ASSERT(m_wheelTimerCount == 0);
+    while (m_wheels.size() < shards)
+    {
+        m_wheels.push_back(new TimingWheel(m_wheelTimerCount));
+    }
 }
 
 Ref<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
 {
     Ref<Timer> timer(new Timer(ms, cb, recurring, this));
+    if (m_useWheel)
+    {
+        size_t shard = getTimerShard();
+        //工作线程自己的时间轮在它下次进入idle时会重新计算超时，不需要唤醒
+        if (m_wheels[shard < m_wheels.size() ? shard : 0]->add(timer) && shard == 0)
+            onTimerInsertAtFront();
+        return timer;
+    }
     RWMutexType::WriteLockGuard lock(m_mutex);
     addTimer(timer, lock);
     return timer;
@@ -138,8 +456,17 @@ Ref<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
 
 uint64_t TimerManager::getNextTimer()
 {
+    if (m_useWheel)
+    {
+        uint64_t now_time = GetCurrentMs();
+        size_t shard = getTimerShard();
+        uint64_t next = m_wheels[0]->getNext(now_time);
+        if (shard != 0 && shard < m_wheels.size())
+            next = std::min(next, m_wheels[shard]->getNext(now_time));
+        return next;
+    }
     RWMutexType::ReadLockGuard lock(m_mutex);
-    m_tickled = true;
+    m_tickled = false;
     if (m_timers.empty())
         return ~0ull;
     uint64_t now_time = GetCurrentMs();
@@ -155,6 +482,16 @@ uint64_t TimerManager::getNextTimer()
 void TimerManager::listExpireCB(std::vector<std::function<void()>>& cbs)
 {
     uint64_t now_time = GetCurrentMs();
+    if (m_useWheel)
+    {
+        if (m_wheelTimerCount == 0)
+            return;
+        size_t shard = getTimerShard();
+        m_wheels[0]->expire(now_time, cbs);
+        if (shard != 0 && shard < m_wheels.size())
+            m_wheels[shard]->expire(now_time, cbs);
+        return;
+    }
     std::vector<Ref<Timer>> expire;
     {
         RWMutexType::ReadLockGuard lock(m_mutex);
@@ -194,6 +531,8 @@ void TimerManager::listExpireCB(std::vector<std::function<void()>>& cbs)
 
 bool TimerManager::hasTimer()
 {
+    if (m_useWheel)
+        return m_wheelTimerCount > 0;
     RWMutexType::ReadLockGuard lock(m_mutex);
     return !m_timers.empty();
 }
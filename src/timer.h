@@ -8,9 +8,11 @@ namespace TinyServer
 {
 
 class TimerManager;
+class TimingWheel;
 class Timer : public std::enable_shared_from_this<Timer>
 {
 friend class TimerManager;
+friend class TimingWheel;
 public:
     bool cancle();
     bool refresh();
@@ -21,6 +23,9 @@ private:
 
     Timer(uint64_t now_time);
 
+    //时间轮模式下的refresh/reset
+    bool resetInWheel(uint64_t ms, bool from_now);
+
 private:
     struct Compare
     {
@@ -33,6 +38,13 @@ private:
     std::function<void()> m_cb; //定时器任务
     bool m_recurring;   //是否循环执行定时器
     TimerManager* m_manager;
+
+    //时间轮模式下使用
+    std::atomic<TimingWheel*> m_wheel = {nullptr};  //所在的时间轮
+    Timer* m_wheelPrev = nullptr;                   //槽内双向链表
+    Timer* m_wheelNext = nullptr;
+    uint32_t m_slot = 0;                            //所在的槽
+    Ref<Timer> m_self;                              //在时间轮中时持有自身
 };
 
 class TimerManager
@@ -59,6 +71,11 @@ public:
 protected:
     virtual void onTimerInsertAtFront() = 0;
 
+    //时间轮模式: 定时器放入当前线程对应的时间轮，0为外部线程共用
+    virtual size_t getTimerShard() { return 0; }
+    //时间轮模式下创建shards个时间轮，需要在工作线程启动前调用
+    void initTimerShards(size_t shards);
+
 private:
     bool detectClockRollover(uint64_t now_time);
 
@@ -67,6 +84,10 @@ private:
     std::set<Ref<Timer>, Timer::Compare> m_timers;
     bool m_tickled = false;
     uint64_t m_previousTime = 0;
+
+    bool m_useWheel;                        //timer.wheel.enable
+    std::vector<TimingWheel*> m_wheels;
+    std::atomic<size_t> m_wheelTimerCount = {0};
 };
 
 
@@ -0,0 +1,256 @@
+#include "uring.h"
+
+#ifdef TINY_HAVE_IO_URING
+#include "log.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace TinyServer
+{
+static Ref<Logger> logger = TINY_LOG_NAME("system");
+
+#ifdef __NR_io_uring_setup
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+#else
+static int sys_io_uring_setup(unsigned, io_uring_params*)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int sys_io_uring_enter(int, unsigned, unsigned, unsigned)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int sys_io_uring_register(int, unsigned, void*, unsigned)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+IOUring::IOUring()
+    : m_fd(-1), m_sqEntries(0), m_cqEntries(0), m_toSubmit(0)
+    , m_sqRing(MAP_FAILED), m_sqRingSize(0)
+    , m_cqRing(MAP_FAILED), m_cqRingSize(0)
+    , m_sqes((io_uring_sqe*)MAP_FAILED), m_sqesSize(0)
+{
+
+}
+
+IOUring::~IOUring()
+{
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED)
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool IOUring::init(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = sys_io_uring_setup(entries, &params);
+    if (m_fd < 0)
+    {
+        TINY_LOG_INFO(logger) << "io_uring_setup(" << entries << ") errno = "
+            << errno << " errstr = " << strerror(errno);
+        return false;
+    }
+    m_sqEntries = params.sq_entries;
+    m_cqEntries = params.cq_entries;
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    //5.4之后SQ和CQ共用一次mmap
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED)
+        return false;
+    if (single_mmap)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED)
+            return false;
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+        return false;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    m_sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqArray = (unsigned*)(sq + params.sq_off.array);
+    m_sqFlags = (unsigned*)(sq + params.sq_off.flags);
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool IOUring::submit(const io_uring_sqe* sqes, unsigned count)
+{
+    MutexType::MutexLockGuard lock(m_sqMutex);
+    unsigned tail = *m_sqTail;
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (tail - head + count > m_sqEntries)
+        return false;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned index = (tail + i) & *m_sqMask;
+        m_sqes[index] = sqes[i];
+        m_sqArray[index] = index;
+    }
+    __atomic_store_n(m_sqTail, tail + count, __ATOMIC_RELEASE);
+    m_toSubmit += count;
+
+    int res = sys_io_uring_enter(m_fd, m_toSubmit, 0, 0);
+    if (res > 0)
+    {
+        m_toSubmit -= std::min((unsigned)res, m_toSubmit);
+        return true;
+    }
+    //内核一个都没有取走时撤回，交给调用者走epoll
+    if (m_toSubmit == count)
+    {
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+        m_toSubmit = 0;
+        TINY_LOG_ERROR(logger) << "io_uring_enter(" << m_fd << ", " << count << ") res = " << res
+            << " errno = " << errno << " errstr = " << strerror(errno);
+        return false;
+    }
+    //前面还有残留的sqe，本次的留在SQ中随下一次enter提交
+    return true;
+}
+
+size_t IOUring::reap(io_uring_cqe* cqes, size_t max)
+{
+    MutexType::MutexLockGuard lock(m_cqMutex);
+#ifdef IORING_SQ_CQ_OVERFLOW
+    //CQ满时内核把cqe暂存在溢出列表中，要进入内核才会搬回CQ
+    if (__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+    {
+        sys_io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+#endif
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while (head != tail && n < max)
+    {
+        cqes[n++] = m_cqes[head & *m_cqMask];
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+bool IOUring::hasCompletion() const
+{
+    return __atomic_load_n(m_cqHead, __ATOMIC_RELAXED) != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+}
+
+//hook的close要按fd取消未完成的请求(io_uring持有socket的引用，不取消的话读会一直挂起)
+//IORING_ASYNC_CANCEL_FD需要5.19，旧内核对非0的cancel_flags返回-EINVAL
+static bool probe_cancel_fd(IOUring& ring)
+{
+#ifdef IORING_ASYNC_CANCEL_FD
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = ring.getFd();
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    if (!ring.submit(&sqe, 1))
+        return false;
+    io_uring_cqe cqe;
+    while (ring.reap(&cqe, 1) == 0)
+    {
+        if (sys_io_uring_enter(ring.getFd(), 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return false;
+    }
+    //没有可取消的请求，支持时返回0或-ENOENT
+    if (cqe.res == -EINVAL)
+    {
+        TINY_LOG_INFO(logger) << "io_uring IORING_ASYNC_CANCEL_FD not supported";
+        return false;
+    }
+    return true;
+#else
+    TINY_LOG_INFO(logger) << "io_uring headers lack IORING_ASYNC_CANCEL_FD";
+    return false;
+#endif
+}
+
+static bool probe_io_uring()
+{
+    IOUring ring;
+    if (!ring.init(2))
+        return false;
+    static const unsigned OPS_COUNT = 256;
+    size_t len = sizeof(io_uring_probe) + OPS_COUNT * sizeof(io_uring_probe_op);
+    io_uring_probe* probe = (io_uring_probe*)calloc(1, len);
+    int res = sys_io_uring_register(ring.getFd(), IORING_REGISTER_PROBE, probe, OPS_COUNT);
+    bool ok = res == 0;
+    static const int s_ops[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV,
+        IORING_OP_RECV, IORING_OP_SEND, IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ACCEPT,
+        IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL};
+    for (size_t i = 0; ok && i < sizeof(s_ops) / sizeof(s_ops[0]); ++i)
+    {
+        int op = s_ops[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            TINY_LOG_INFO(logger) << "io_uring opcode " << op << " not supported";
+            ok = false;
+        }
+    }
+    free(probe);
+    return ok && probe_cancel_fd(ring);
+}
+
+bool IOUring::IsSupported()
+{
+    static bool s_supported = probe_io_uring();
+    return s_supported;
+}
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "thread.h"
+#include "noncoptable.h"
+
+//io_uring后端，只用内核头文件和原始系统调用，不依赖liburing
+//没有<linux/io_uring.h>时整个后端不编译，IOManager只使用epoll
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TINY_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef TINY_HAVE_IO_URING
+#include <linux/io_uring.h>
+
+namespace TinyServer
+{
+//多个线程共享的一个ring: 提交和收割各自加锁
+//每次submit都立即io_uring_enter，SQ中不会积压请求
+class IOUring : Noncopyable
+{
+public:
+    typedef MutexLock MutexType;
+    IOUring();
+    ~IOUring();
+
+    //entries为SQ大小，失败返回false(内核不支持或被seccomp禁止)
+    bool init(unsigned entries);
+    int getFd() const { return m_fd; }
+    unsigned getCqEntries() const { return m_cqEntries; }
+
+    //按顺序提交count个sqe(可以用IOSQE_IO_LINK串起来)，失败返回false且没有任何sqe被提交
+    bool submit(const io_uring_sqe* sqes, unsigned count);
+    //从CQ中取出最多max个cqe，返回取出的数量，CQ溢出时才进入内核
+    size_t reap(io_uring_cqe* cqes, size_t max);
+    //CQ中是否有未取出的cqe
+    bool hasCompletion() const;
+
+    //内核是否支持io_uring以及hook用到的所有操作，只探测一次
+    static bool IsSupported();
+
+private:
+    int m_fd;
+    unsigned m_sqEntries;
+    unsigned m_cqEntries;
+    unsigned m_toSubmit;        //已经写入SQ还没有被内核取走的数量
+    void* m_sqRing;
+    size_t m_sqRingSize;
+    void* m_cqRing;
+    size_t m_cqRingSize;
+    io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned* m_sqMask;
+    unsigned* m_sqArray;
+    unsigned* m_sqFlags;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned* m_cqMask;
+    io_uring_cqe* m_cqes;
+
+    MutexType m_sqMutex;
+    MutexType m_cqMutex;
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "log.h"
 #include <execinfo.h>
 #include "fiber.h"
+#include "macro.h"
 #include <sys/time.h>
 #include <dirent.h>
 #include <string.h>
@@ -14,9 +15,27 @@ namespace TinyServer
 {
 Ref<Logger> logger = TINY_LOG_NAME("system");
 
+//gettid是一次系统调用，每条日志都要取，缓存在线程局部变量中
+//fork之后子进程里的线程id会变，由atfork回调清除
+static thread_local pid_t t_thread_id = 0;
+
+struct ThreadIdIniter
+{
+    ThreadIdIniter()
+    {
+        pthread_atfork(nullptr, nullptr, [](){
+            t_thread_id = 0;
+        });
+    }
+};
+
+static ThreadIdIniter s_thread_id_initer;
+
 pid_t GetThreadId()
 {
-    return syscall(SYS_gettid);
+    if (TINY_UNLICKLY(!t_thread_id))
+        t_thread_id = syscall(SYS_gettid);
+    return t_thread_id;
 }
 u_int32_t GetFiberId()
 {
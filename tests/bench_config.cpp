@@ -0,0 +1,80 @@
+#include "TinyServer.h"
+
+using namespace TinyServer;
+
+//1~32个线程同时读取同一个配置项，对比无锁的ConfigVar::getValue和原来读锁保护的读取方式
+//另有一个线程每毫秒setValue一次，读者不应受写者影响
+
+static Ref<ConfigVar<int>> g_bench_value = Config::Lookup("bench.config.value", 1, "bench config value");
+
+static const int s_total_reads = 32000000;
+
+//原实现: 每次读取都加pthread读锁
+static RWLock s_rwlock;
+static int s_locked_value = 1;
+
+void bench(bool locked, int threads)
+{
+    int reads = s_total_reads / threads;
+    std::atomic<bool> stop {false};
+    Thread writer([&stop, locked](){
+        int i = 0;
+        while (!stop)
+        {
+            if (locked)
+            {
+                RWLock::WriteLockGuard lock(s_rwlock);
+                s_locked_value = 1 + (++i & 1);
+            }
+            else
+            {
+                g_bench_value->setValue(1 + (++i & 1));
+            }
+            usleep(1000);
+        }
+    }, "bench_writer");
+
+    uint64_t begin = GetCurrentUs();
+    std::vector<Ref<Thread>> thrs;
+    std::atomic<uint64_t> sum {0};
+    for (int i = 0; i < threads; ++i)
+    {
+        thrs.push_back(Ref<Thread>(new Thread([reads, locked, &sum](){
+            uint64_t local = 0;
+            for (int j = 0; j < reads; ++j)
+            {
+                if (locked)
+                {
+                    RWLock::ReadLockGuard lock(s_rwlock);
+                    local += s_locked_value;
+                }
+                else
+                {
+                    local += g_bench_value->getValue();
+                }
+            }
+            sum += local;
+        }, "bench_" + std::to_string(i))));
+    }
+    for (auto& t : thrs)
+    {
+        t->join();
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    stop = true;
+    writer.join();
+    std::cout << (locked ? "rwlock  " : "lockfree") << " threads=" << threads << " "
+        << (uint64_t)(reads * (double)threads / us) << " Mreads/s" << std::endl;
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    int threads[] = {1, 2, 4, 8, 16, 32};
+    for (int t : threads)
+    {
+        bench(true, t);
+        bench(false, t);
+    }
+    return 0;
+}
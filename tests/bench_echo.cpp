@@ -0,0 +1,157 @@
+#include "TinyServer.h"
+#include "tcp_server.h"
+#include "iomanager.h"
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <stdarg.h>
+#include <dlfcn.h>
+
+using namespace TinyServer;
+
+//基于examples/echo_server.cpp的回显服务，对比epoll和io_uring两种IO后端
+//同一进程内先后以 iomanager.io_uring.enable = false / true 各跑一遍
+//拦截epoll_ctl/epoll_wait/syscall(io_uring_enter)统计每个请求的事件循环系统调用次数
+
+static std::atomic<uint64_t> s_epoll_calls {0};
+static std::atomic<uint64_t> s_uring_enter {0};
+
+extern "C"
+{
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    typedef int (*fun_t)(int, int, int, struct epoll_event*);
+    static fun_t real = (fun_t)dlsym(RTLD_NEXT, "epoll_ctl");
+    ++s_epoll_calls;
+    return real(epfd, op, fd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
+{
+    typedef int (*fun_t)(int, struct epoll_event*, int, int);
+    static fun_t real = (fun_t)dlsym(RTLD_NEXT, "epoll_wait");
+    ++s_epoll_calls;
+    return real(epfd, events, maxevents, timeout);
+}
+
+long syscall(long number, ...)
+{
+    typedef long (*fun_t)(long, ...);
+    static fun_t real = (fun_t)dlsym(RTLD_NEXT, "syscall");
+    va_list va;
+    va_start(va, number);
+    long a[6];
+    for (int i = 0; i < 6; ++i)
+    {
+        a[i] = va_arg(va, long);
+    }
+    va_end(va);
+#ifdef __NR_io_uring_enter
+    if (number == __NR_io_uring_enter)
+        ++s_uring_enter;
+#endif
+    return real(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+}
+
+static const int s_clients = 64;
+static const int s_requests = 2000;
+static const size_t s_msg_size = 64;
+
+class EchoServer : public TCPServer
+{
+public:
+    void handleClient(Ref<Socket> client) override
+    {
+        char buf[1024];
+        while (true)
+        {
+            int res = client->recv(buf, sizeof(buf));
+            if (res <= 0)
+                break;
+            if (client->send(buf, res) != res)
+                break;
+        }
+    }
+};
+
+static std::atomic<int> s_finished {0};
+
+void client(Ref<Address> addr, Ref<EchoServer> server)
+{
+    Ref<Socket> sock = Socket::CreateTCP(addr);
+    if (sock->connect(addr))
+    {
+        char buf[s_msg_size] = "ping";
+        for (int i = 0; i < s_requests; ++i)
+        {
+            if (sock->send(buf, s_msg_size) != (int)s_msg_size)
+                break;
+            size_t got = 0;
+            while (got < s_msg_size)
+            {
+                int res = sock->recv(buf + got, s_msg_size - got);
+                if (res <= 0)
+                    break;
+                got += res;
+            }
+            if (got != s_msg_size)
+                break;
+        }
+    }
+    else
+    {
+        std::cout << "connect " << *addr << " failed errno = " << errno << std::endl;
+    }
+    sock->close();
+    if (++s_finished == s_clients)
+        server->stop();
+}
+
+void bench(bool uring)
+{
+    Config::Lookup<bool>("iomanager.io_uring.enable")->setValue(uring);
+    s_finished = 0;
+    uint64_t begin = GetCurrentUs();
+    uint64_t epoll_calls = 0;
+    uint64_t uring_enter = 0;
+    bool has_uring = false;
+    {
+        IOManager iom(2, false, "bench");
+        has_uring = iom.hasUring();
+        epoll_calls = s_epoll_calls;
+        uring_enter = s_uring_enter;
+        iom.schedule([](){
+            Ref<EchoServer> server(new EchoServer);
+            Ref<Address> addr = Address::LookupAny("127.0.0.1:8030");
+            while (!server->bind(addr))
+            {
+                sleep(1);
+            }
+            server->start();
+            for (int i = 0; i < s_clients; ++i)
+            {
+                IOManager::GetThis()->schedule(std::bind(&client, addr, server));
+            }
+        });
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    double total = s_clients * s_requests;
+    std::cout << (has_uring ? "io_uring" : "epoll   ")
+        << " requests=" << (uint64_t)total
+        << " epoll/req=" << (s_epoll_calls - epoll_calls) / total
+        << " io_uring_enter/req=" << (s_uring_enter - uring_enter) / total
+        << " " << (uint64_t)(total * 1000000.0 / us) << " req/s" << std::endl;
+    if (uring && !has_uring)
+    {
+        std::cout << "io_uring unavailable, fell back to epoll" << std::endl;
+    }
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::ERROR);
+    bench(false);
+    bench(true);
+    return 0;
+}
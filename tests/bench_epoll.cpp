@@ -0,0 +1,99 @@
+#include "TinyServer.h"
+#include "iomanager.h"
+#include "fd_manager.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <dlfcn.h>
+
+using namespace TinyServer;
+
+//每个请求的epoll系统调用次数: 通过在可执行文件中定义同名函数拦截epoll_ctl/epoll_wait计数
+//分别测试 iomanager.epoll.persistent = false(每次事件重新注册) 和 true(常驻边缘触发)
+
+static std::atomic<uint64_t> s_epoll_ctl {0};
+static std::atomic<uint64_t> s_epoll_wait {0};
+
+extern "C"
+{
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    typedef int (*fun_t)(int, int, int, struct epoll_event*);
+    static fun_t real = (fun_t)dlsym(RTLD_NEXT, "epoll_ctl");
+    ++s_epoll_ctl;
+    return real(epfd, op, fd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
+{
+    typedef int (*fun_t)(int, struct epoll_event*, int, int);
+    static fun_t real = (fun_t)dlsym(RTLD_NEXT, "epoll_wait");
+    ++s_epoll_wait;
+    return real(epfd, events, maxevents, timeout);
+}
+}
+
+static const int s_pairs = 64;
+static const int s_requests = 2000;
+
+void server(int fd)
+{
+    char buf[64];
+    while (true)
+    {
+        int n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        write(fd, buf, n);
+    }
+    close(fd);
+}
+
+void client(int fd)
+{
+    char buf[64] = "ping";
+    for (int i = 0; i < s_requests; ++i)
+    {
+        write(fd, buf, 4);
+        if (read(fd, buf, 4) != 4)
+            break;
+    }
+    close(fd);
+}
+
+void bench(bool persistent)
+{
+    Config::Lookup<bool>("iomanager.epoll.persistent")->setValue(persistent);
+    uint64_t begin = GetCurrentUs();
+    uint64_t ctl = 0;
+    uint64_t wait = 0;
+    {
+        IOManager iom(2, false, "bench");
+        ctl = s_epoll_ctl;
+        wait = s_epoll_wait;
+        for (int i = 0; i < s_pairs; ++i)
+        {
+            int sv[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+            FdMgr::GetInstance()->get(sv[0], true);
+            FdMgr::GetInstance()->get(sv[1], true);
+            iom.schedule(std::bind(&server, sv[0]));
+            iom.schedule(std::bind(&client, sv[1]));
+        }
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    double total = s_pairs * s_requests;
+    std::cout << (persistent ? "persistent" : "rearm     ")
+        << " requests=" << (uint64_t)total
+        << " epoll_ctl/req=" << (s_epoll_ctl - ctl) / total
+        << " epoll_wait/req=" << (s_epoll_wait - wait) / total
+        << " " << (uint64_t)(total * 1000000.0 / us) << " req/s" << std::endl;
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::ERROR);
+    bench(false);
+    bench(true);
+    return 0;
+}
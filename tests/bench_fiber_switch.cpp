@@ -0,0 +1,82 @@
+#include "TinyServer.h"
+#include <ucontext.h>
+
+using namespace TinyServer;
+
+//协程切换压测: 分别测试Fiber(当前编译的后端)和裸ucontext的每秒切换次数
+//cmake -DTINY_FIBER_USE_UCONTEXT=ON 可以让Fiber使用ucontext后端对比
+
+static const uint64_t s_rounds = 10000000;
+
+static uint64_t s_count = 0;
+static Fiber* s_fiber = nullptr;
+
+void fiber_pingpong()
+{
+    while (true)
+    {
+        ++s_count;
+        s_fiber->back();
+    }
+}
+
+static void report(const char* name, uint64_t switches, uint64_t us)
+{
+    std::cout << name << ": " << switches << " switches in " << us / 1000.0 << " ms, "
+        << (uint64_t)(switches * 1000000.0 / us) << " switches/s, "
+        << us * 1000.0 / switches << " ns/switch" << std::endl;
+}
+
+void bench_fiber()
+{
+    Fiber::GetThis();
+    Ref<Fiber> fiber(new Fiber(&fiber_pingpong, 0, true));
+    s_fiber = fiber.get();
+    uint64_t begin = GetCurrentUs();
+    for (uint64_t i = 0; i < s_rounds; ++i)
+    {
+        fiber->call();
+    }
+    uint64_t end = GetCurrentUs();
+    report((std::string("fiber ") + Fiber::ContextBackend()).c_str(), s_rounds * 2, end - begin);
+    //协程没有结束，结束前置为TERM以便析构
+    fiber->setState(Fiber::TERM);
+}
+
+static ucontext_t s_main_ctx;
+static ucontext_t s_uc_ctx;
+
+static void uc_pingpong()
+{
+    while (true)
+    {
+        ++s_count;
+        swapcontext(&s_uc_ctx, &s_main_ctx);
+    }
+}
+
+void bench_ucontext()
+{
+    std::vector<char> stack(128 * 1024);
+    getcontext(&s_uc_ctx);
+    s_uc_ctx.uc_link = nullptr;
+    s_uc_ctx.uc_stack.ss_sp = &stack[0];
+    s_uc_ctx.uc_stack.ss_size = stack.size();
+    makecontext(&s_uc_ctx, &uc_pingpong, 0);
+    uint64_t begin = GetCurrentUs();
+    for (uint64_t i = 0; i < s_rounds; ++i)
+    {
+        swapcontext(&s_main_ctx, &s_uc_ctx);
+    }
+    uint64_t end = GetCurrentUs();
+    report("raw ucontext", s_rounds * 2, end - begin);
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::ERROR);
+    bench_fiber();
+    bench_ucontext();
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "TinyServer.h"
+#include "iomanager.h"
+#include "http/http_server.h"
+#include "http/http_connection.h"
+
+using namespace TinyServer;
+
+//多个协程通过HttpConnectionPool并发请求本地服务器，统计吞吐和服务器收到的连接数
+//连接数远小于请求数说明连接被复用，没有反复重连
+
+static const int s_clients = 64;
+static const int s_requests = 500;     //每个协程的请求数
+
+static std::atomic<int> s_finished {0};
+static std::atomic<uint64_t> s_ok {0};
+static std::atomic<uint64_t> s_connections {0};
+
+void client(Ref<http::HttpConnectionPool> pool, Ref<http::HttpServer> server)
+{
+    for (int i = 0; i < s_requests; ++i)
+    {
+        auto r = pool->doGet("/ping", 3000);
+        if (r->result != 0)
+        {
+            std::cout << r->error << std::endl;
+            break;
+        }
+        ++s_ok;
+    }
+    if (++s_finished == s_clients)
+        server->stop();
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::FATAL);
+    uint64_t begin = GetCurrentUs();
+    {
+        IOManager iom(2, false, "bench");
+        iom.schedule([](){
+            Ref<http::HttpServer> server(new http::HttpServer(true));
+            server->getDispatch()->addServlet("/ping", [](Ref<http::HttpRequest> req,
+            Ref<http::HttpResponse> rsp, Ref<http::HttpSession> session){
+                //每个连接上的第一个请求
+                if (session->getRequestCount() == 1)
+                    ++s_connections;
+                rsp->setBody("pong");
+                return 0;
+            });
+            Ref<Address> addr = Address::LookupAny("127.0.0.1:8041");
+            while (!server->bind(addr))
+            {
+                sleep(1);
+            }
+            server->start();
+            Ref<http::HttpConnectionPool> pool(new http::HttpConnectionPool("127.0.0.1", "", 8041, 16, 30 * 1000, 1000));
+            for (int i = 0; i < s_clients; ++i)
+            {
+                IOManager::GetThis()->schedule(std::bind(&client, pool, server));
+            }
+        });
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    std::cout << "clients=" << s_clients << " requests=" << (uint64_t)s_ok << " connections=" << (uint64_t)s_connections
+        << " " << (uint64_t)(s_ok * 1000000.0 / us) << " req/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "TinyServer.h"
+#include <unistd.h>
+#include <new>
+
+using namespace TinyServer;
+
+//统计堆分配次数，格式化路径在预热之后应为0
+static std::atomic<uint64_t> s_allocs {0};
+
+void* operator new(size_t size)
+{
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+//只格式化不输出，衡量宏+LogEvent+LogFormatter本身的开销
+class FormatOnlyLog : public LogAppender
+{
+public:
+    void log(LogLevel::Level level, Ref<Logger>& logger, Ref<LogEvent>& event) override
+    {
+        m_buf.clear();
+        m_formatter->format(m_buf, level, logger, event);
+        m_bytes += m_buf.size();
+    }
+    std::string toYamlString() override { return ""; }
+    uint64_t getBytes() const { return m_bytes; }
+
+private:
+    std::string m_buf;
+    uint64_t m_bytes = 0;
+};
+
+void bench_format()
+{
+    Ref<Logger> logger(new Logger("bench"));
+    Ref<FormatOnlyLog> appender(new FormatOnlyLog);
+    logger->addAppender(appender);
+    static const int s_lines = 1000000;
+    for (int i = 0; i < 1000; ++i)
+    {
+        TINY_LOG_WARN(logger) << "warm up " << i;
+    }
+    uint64_t allocs = s_allocs;
+    uint64_t begin = GetCurrentUs();
+    for (int i = 0; i < s_lines; ++i)
+    {
+        TINY_LOG_WARN(logger) << "bench log line " << i << " of " << s_lines;
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    std::cout << "format only " << us * 1000.0 / s_lines << " ns/line "
+        << (double)(s_allocs - allocs) / s_lines << " allocs/line" << std::endl;
+}
+
+//1~32个线程同时写日志，对比FileLog和AsyncFileLog每秒写入的行数
+//计时包括析构appender(AsyncFileLog要等全部落盘)
+//日志语句都用WARN，打开TINY_LOG_STRIP_DEBUG_INFO编译时同样可以测
+
+static const int s_total_lines = 400000;
+
+void bench(const std::string& type, int threads)
+{
+    std::string file = "bench_" + type + ".txt";
+    unlink(file.c_str());
+    Ref<Logger> logger(new Logger("bench"));
+    {
+        Ref<LogAppender> appender;
+        if (type == "FileLog")
+            appender.reset(new FileLog(file));
+        else
+            appender.reset(new AsyncFileLog(file));
+        logger->addAppender(appender);
+    }
+
+    int lines = s_total_lines / threads;
+    uint64_t begin = GetCurrentUs();
+    std::vector<Ref<Thread>> thrs;
+    for (int i = 0; i < threads; ++i)
+    {
+        thrs.push_back(Ref<Thread>(new Thread([logger, lines](){
+            for (int j = 0; j < lines; ++j)
+            {
+                TINY_LOG_WARN(logger) << "bench log line " << j << " of " << lines;
+            }
+        }, "bench_" + std::to_string(i))));
+    }
+    for (auto& t : thrs)
+    {
+        t->join();
+    }
+    logger->clearAppenders();
+    uint64_t us = GetCurrentUs() - begin;
+    unlink(file.c_str());
+    std::cout << type << " threads=" << threads << " "
+        << (uint64_t)(lines * threads * 1000000.0 / us) << " lines/s" << std::endl;
+}
+
+//级别关闭的日志语句的开销，流式参数不应被求值
+void bench_disabled()
+{
+    Ref<Logger> logger(new Logger("bench"));
+    logger->addAppender(Ref<FormatOnlyLog>(new FormatOnlyLog));
+    logger->setLevel(LogLevel::ERROR);
+    static const int s_lines = 10000000;
+    uint64_t evaluated = 0;
+    uint64_t begin = GetCurrentUs();
+    for (int i = 0; i < s_lines; ++i)
+    {
+        TINY_LOG_DEBUG(logger) << "disabled line " << ++evaluated;
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    std::cout << "disabled debug (runtime level) " << us * 1000.0 / s_lines << " ns/stmt evaluated="
+        << evaluated << (TINY_LOG_ACTIVE_LEVEL > LogLevel::DEBUG ? " (compiled out)" : "") << std::endl;
+}
+
+int main()
+{
+    bench_disabled();
+    bench_format();
+    int threads[] = {1, 2, 4, 8, 16, 32};
+    for (int t : threads)
+    {
+        bench("FileLog", t);
+        bench("AsyncFileLog", t);
+    }
+    return 0;
+}
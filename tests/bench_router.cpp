@@ -0,0 +1,80 @@
+#include "TinyServer.h"
+#include "http/servlet.h"
+#include <fnmatch.h>
+
+using namespace TinyServer;
+
+//10/100/1000条路由时ServletDispatch::getMatchedServlet每次查找的耗时
+//对比原来的做法: 带参数的路由只能写成glob，按注册顺序逐个fnmatch
+
+static const int s_lookups = 200000;
+
+static int32_t noop(Ref<http::HttpRequest>, Ref<http::HttpResponse>, Ref<http::HttpSession>)
+{
+    return 0;
+}
+
+void bench(int routes)
+{
+    Ref<http::ServletDispatch> dispatch(new http::ServletDispatch);
+    std::vector<std::string> globs;
+    std::vector<std::string> uris;
+    for (int i = 0; i < routes; ++i)
+    {
+        std::string svc = "/api/v1/svc" + std::to_string(i);
+        dispatch->addRoute(svc + "/users/:id/orders", &noop);
+        dispatch->addGlobServlet("/static" + std::to_string(i) + "/*", &noop);
+        globs.push_back(svc + "/users/*/orders");
+        uris.push_back(svc + "/users/" + std::to_string(i * 7) + "/orders");
+    }
+
+    Ref<http::HttpRequest> req(new http::HttpRequest);
+    uint64_t begin = GetCurrentUs();
+    size_t found = 0;
+    for (int i = 0; i < s_lookups; ++i)
+    {
+        found += dispatch->getMatchedServlet(uris[i % routes], req) != dispatch->getDefault();
+    }
+    uint64_t route_us = GetCurrentUs() - begin;
+
+    std::string last_static = "/static" + std::to_string(routes - 1) + "/js/app.js";
+    begin = GetCurrentUs();
+    for (int i = 0; i < s_lookups; ++i)
+    {
+        found += dispatch->getMatchedServlet(last_static) != dispatch->getDefault();
+    }
+    uint64_t glob_us = GetCurrentUs() - begin;
+
+    begin = GetCurrentUs();
+    for (int i = 0; i < s_lookups; ++i)
+    {
+        const std::string& uri = uris[i % routes];
+        for (auto& glob : globs)
+        {
+            if (!fnmatch(glob.c_str(), uri.c_str(), 0))
+            {
+                ++found;
+                break;
+            }
+        }
+    }
+    uint64_t fnmatch_us = GetCurrentUs() - begin;
+
+    std::cout << "routes=" << routes
+        << " radix(:param)=" << route_us * 1000.0 / s_lookups << "ns"
+        << " radix(glob prefix)=" << glob_us * 1000.0 / s_lookups << "ns"
+        << " fnmatch=" << fnmatch_us * 1000.0 / s_lookups << "ns"
+        << " found=" << found << std::endl;
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::ERROR);
+    int routes[] = {10, 100, 1000};
+    for (int r : routes)
+    {
+        bench(r);
+    }
+    return 0;
+}
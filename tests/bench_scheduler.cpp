@@ -0,0 +1,57 @@
+#include "TinyServer.h"
+
+using namespace TinyServer;
+
+//调度器吞吐压测: 每个根任务再派生若干子任务(工作线程本地投递)
+//对比 scheduler.work_stealing = true(每线程队列+窃取) 和 false(共享一个队列)
+
+static const int s_roots = 2000;
+static const int s_children = 50;
+static std::atomic<uint64_t> s_done {0};
+
+static void child_task()
+{
+    ++s_done;
+}
+
+static void root_task()
+{
+    Scheduler* sc = Scheduler::GetThis();
+    for (int i = 0; i < s_children; ++i)
+    {
+        sc->schedule(&child_task);
+    }
+    ++s_done;
+}
+
+void bench(size_t threads, bool work_stealing)
+{
+    Config::Lookup<bool>("scheduler.work_stealing")->setValue(work_stealing);
+    s_done = 0;
+    uint64_t begin = GetCurrentUs();
+    {
+        Scheduler sc(threads, false, "bench");
+        for (int i = 0; i < s_roots; ++i)
+        {
+            sc.schedule(&root_task);
+        }
+        sc.start();
+        sc.stop();
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    std::cout << "threads=" << threads << " " << (work_stealing ? "work_stealing" : "shared_queue")
+        << " tasks=" << s_done << " " << (uint64_t)(s_done * 1000000.0 / us) << " tasks/s" << std::endl;
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::ERROR);
+    size_t threads[] = {1, 4, 16, 64};
+    for (auto n : threads)
+    {
+        bench(n, false);
+        bench(n, true);
+    }
+    return 0;
+}
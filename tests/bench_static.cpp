@@ -0,0 +1,153 @@
+#include "TinyServer.h"
+#include "iomanager.h"
+#include "http/http_server.h"
+#include "http/static_file_servlet.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace TinyServer;
+
+//StaticFileServlet(sendfile)发送1KiB、1MiB、100MiB文件的吞吐
+//客户端在keep-alive连接上循环GET，只解析content-length，body读出来直接丢弃
+
+static const std::string s_root = "/tmp/bench_static";
+
+struct Case
+{
+    const char* name;
+    size_t size;
+    int clients;
+    int requests;       //每个客户端的请求数
+};
+
+static const Case s_cases[] = {
+    {"1k.bin", 1024, 16, 4000},
+    {"1m.bin", 1024 * 1024, 8, 100},
+    {"100m.bin", 100 * 1024 * 1024, 2, 4},
+};
+
+static void create_file(const std::string& path, size_t size)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string buf(1024 * 1024, 'x');
+    while (size > 0)
+    {
+        size_t n = std::min(size, buf.size());
+        if (write(fd, buf.data(), n) != (ssize_t)n)
+            break;
+        size -= n;
+    }
+    close(fd);
+}
+
+//读一个响应，返回body长度，失败返回-1
+static int64_t read_response(Ref<Socket> sock, std::vector<char>& buf)
+{
+    size_t len = 0;
+    const char* end = nullptr;
+    while (!end)
+    {
+        int res = sock->recv(&buf[len], buf.size() - len);
+        if (res <= 0)
+            return -1;
+        len += res;
+        end = (const char*)memmem(&buf[0], len, "\r\n\r\n", 4);
+    }
+    const char* cl = (const char*)memmem(&buf[0], end - &buf[0], "content-length: ", 16);
+    if (!cl)
+        return -1;
+    uint64_t length = strtoull(cl + 16, nullptr, 10);
+    uint64_t got = len - (end + 4 - &buf[0]);
+    while (got < length)
+    {
+        int res = sock->recv(&buf[0], std::min((uint64_t)buf.size(), length - got));
+        if (res <= 0)
+            return -1;
+        got += res;
+    }
+    return length;
+}
+
+static std::atomic<int> s_finished {0};
+static std::atomic<uint64_t> s_bytes {0};
+
+void client(Ref<Address> addr, const Case& c, Ref<http::HttpServer> server)
+{
+    Ref<Socket> sock = Socket::CreateTCP(addr);
+    if (sock->connect(addr))
+    {
+        std::string req = std::string("GET /static/") + c.name
+            + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+        std::vector<char> buf(64 * 1024);
+        for (int i = 0; i < c.requests; ++i)
+        {
+            if (sock->send(req.data(), req.size()) != (int)req.size())
+                break;
+            int64_t len = read_response(sock, buf);
+            if (len != (int64_t)c.size)
+            {
+                std::cout << c.name << " bad response length " << len << std::endl;
+                break;
+            }
+            s_bytes += len;
+        }
+    }
+    else
+    {
+        std::cout << "connect " << *addr << " failed errno = " << errno << std::endl;
+    }
+    sock->close();
+    if (++s_finished == c.clients)
+        server->stop();
+}
+
+void bench(const Case& c)
+{
+    s_finished = 0;
+    s_bytes = 0;
+    uint64_t begin = GetCurrentUs();
+    {
+        IOManager iom(1, false, "bench");
+        iom.schedule([&c](){
+            Ref<http::HttpServer> server(new http::HttpServer(true));
+            server->getDispatch()->addGlobServlet("/static/*",
+                Ref<http::Servlet>(new http::StaticFileServlet("/static/", s_root)));
+            Ref<Address> addr = Address::LookupAny("127.0.0.1:8040");
+            while (!server->bind(addr))
+            {
+                sleep(1);
+            }
+            server->start();
+            for (int i = 0; i < c.clients; ++i)
+            {
+                IOManager::GetThis()->schedule(std::bind(&client, addr, std::cref(c), server));
+            }
+        });
+    }
+    uint64_t us = GetCurrentUs() - begin;
+    double requests = c.clients * c.requests;
+    std::cout << c.name << " clients=" << c.clients << " requests=" << (uint64_t)requests
+        << " " << (uint64_t)(requests * 1000000.0 / us) << " req/s "
+        << (uint64_t)(s_bytes * 1000000.0 / us / 1024 / 1024) << " MiB/s" << std::endl;
+}
+
+int main()
+{
+    TINY_LOG_ROOT->setLevel(LogLevel::ERROR);
+    TINY_LOG_NAME("system")->setLevel(LogLevel::ERROR);
+    FSUtil::Mkdir(s_root);
+    for (auto& c : s_cases)
+    {
+        create_file(s_root + "/" + c.name, c.size);
+    }
+    for (auto& c : s_cases)
+    {
+        bench(c);
+    }
+    for (auto& c : s_cases)
+    {
+        FSUtil::Unlink(s_root + "/" + c.name);
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "http/http_server.h"
+#include "http/static_file_servlet.h"
 using namespace TinyServer;
 
 static Ref<Logger> logger = TINY_LOG_ROOT;
@@ -23,6 +24,54 @@ void run()
         return 0;
     });
 
+    server->getDispatch()->addRoute("/user/:id/files/*path", [](Ref<http::HttpRequest> req, 
+    Ref<http::HttpResponse> rsp, Ref<http::HttpSession> session){
+        rsp->setBody("Route: id=" + req->getParma("id") + " path=" + req->getParma("path") + "\r\n");
+        return 0;
+    });
+
+    //query、表单body和cookie在第一次读取时才解析
+    server->getDispatch()->addServlet("/TinyServer/params", [](Ref<http::HttpRequest> req, 
+    Ref<http::HttpResponse> rsp, Ref<http::HttpSession> session){
+        rsp->setBody("Params: name=" + req->getParma("name") + " page=" + std::to_string(req->getParamAs<int>("page", 1))
+            + " theme=" + req->getCookie("theme", "light") + "\r\n");
+        return 0;
+    });
+
+    //大的上传按块读取，不会整个放进内存
+    server->getDispatch()->addServlet("/TinyServer/upload", [](Ref<http::HttpRequest> req, 
+    Ref<http::HttpResponse> rsp, Ref<http::HttpSession> session){
+        Ref<Stream> body = req->getBodyStream();
+        uint64_t total = body ? 0 : req->getBody().size();
+        char buf[4096];
+        int len = 0;
+        while (body && (len = body->read(buf, sizeof(buf))) > 0)
+        {
+            total += len;
+        }
+        rsp->setBody("upload " + std::to_string(total) + " bytes\r\n");
+        return 0;
+    });
+
+    //server-sent events，body分块发出，每秒推送一次
+    server->getDispatch()->addServlet("/TinyServer/events", [](Ref<http::HttpRequest> req, 
+    Ref<http::HttpResponse> rsp, Ref<http::HttpSession> session){
+        rsp->setHeader("Content-Type", "text/event-stream");
+        rsp->setHeader("Cache-Control", "no-cache");
+        Ref<http::HttpChunkedStream> stream = session->beginChunked(rsp);
+        for (int i = 0; stream && i < 5; ++i)
+        {
+            std::string event = "data: " + std::to_string(i) + "\n\n";
+            if (stream->write(event.data(), event.size()) <= 0)
+                break;
+            sleep(1);
+        }
+        return 0;
+    });
+
+    //当前目录下的文件，支持Range和条件请求
+    server->getDispatch()->addGlobServlet("/static/*",
+        Ref<http::Servlet>(new http::StaticFileServlet("/static/", ".")));
 
     server->start();
 }
@@ -48,6 +48,31 @@ void test_timer()
     }, true);
 }
 
+//外部线程投递任务到开始执行的延迟，工作线程都在epoll_wait中等待
+void test_schedule_latency()
+{
+    IOManager iom(2, false, "latency");
+    const int count = 1000;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        usleep(200);
+        Semaphore sem;
+        uint64_t exec = 0;
+        uint64_t begin = GetCurrentUs();
+        iom.schedule([&exec, &sem](){
+            exec = GetCurrentUs();
+            sem.notify();
+        });
+        sem.wait();
+        uint64_t cost = exec - begin;
+        total += cost;
+        max = std::max(max, cost);
+    }
+    TINY_LOG_INFO(logger) << "schedule latency avg = " << total / count << "us max = " << max << "us";
+}
+
 void test1()
 {
     IOManager iom(2, false);
@@ -57,6 +82,7 @@ void test1()
 int main()
 {
     //test1();
+    test_schedule_latency();
     test_timer();
     return 0;
 }
\ No newline at end of file